@@ -0,0 +1,193 @@
+/*
+ * motion.cpp
+ * Point-to-point moves on the Hall-edge position counter
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#include <math.h>
+#include "motion.h"
+
+/* Function to plan a move from one position to another [count] */
+/* vMax [count/s], aMax [count/s^2], jMax [count/s^3], jMax <= 0 for a trapezoidal profile */
+void profileInit(Profile *f, float from, float to, float vMax, float aMax, float jMax)
+{
+    float d = fabsf(to - from);
+    float v = vMax, aPk = aMax, tj = 0.0f, ta, tv;
+    int i;
+
+    f->p0 = from;
+    f->p1 = to;
+    f->dir = to >= from ? 1.0f : -1.0f;
+
+    if (jMax <= 0.0f) {
+        /* Trapezoid: triangle if the distance is too short to reach vMax */
+        if (v * v / aMax > d) {
+            v = sqrtf(d * aMax);
+        }
+        ta = v / aMax;
+    }
+    else {
+        /* S-curve: distance of accel and decel at speed v is v * (2 tj + ta) */
+        if (v * jMax >= aMax * aMax ? v * (v / aMax + aMax / jMax) > d : 2.0f * v * sqrtf(v / jMax) > d) {
+            v = 0.5f * aMax * (sqrtf(aMax * aMax / (jMax * jMax) + 4.0f * d / aMax) - aMax / jMax);
+            if (v * jMax < aMax * aMax) {
+                v = cbrtf(d * d * jMax / 4.0f);
+            }
+        }
+        if (v * jMax >= aMax * aMax) {
+            tj = aMax / jMax;
+            ta = v / aMax - tj;
+        }
+        else {
+            tj = sqrtf(v / jMax);
+            ta = 0.0f;
+            aPk = jMax * tj;
+        }
+    }
+    tv = v > 0.0f ? d / v - (2.0f * tj + ta) : 0.0f;
+    if (tv < 0.0f) {
+        tv = 0.0f;
+    }
+
+    f->vPeak = v;
+    f->seg[0] = f->seg[2] = f->seg[4] = f->seg[6] = tj;
+    f->seg[1] = f->seg[5] = ta;
+    f->seg[3] = tv;
+    f->a0[0] = f->a0[3] = f->a0[4] = 0.0f;
+    f->a0[1] = f->a0[2] = aPk;
+    f->a0[5] = f->a0[6] = -aPk;
+    f->jerk[0] = f->jerk[6] = tj > 0.0f ? jMax : 0.0f;
+    f->jerk[2] = f->jerk[4] = tj > 0.0f ? -jMax : 0.0f;
+    f->jerk[1] = f->jerk[3] = f->jerk[5] = 0.0f;
+    f->T = 0.0f;
+    for (i = 0; i < 7; i++) {
+        f->T += f->seg[i];
+    }
+}
+
+/* Function to obtain reference position [count], velocity [count/s] and acceleration [count/s^2] */
+/* at time t [s] from the start */
+void profileAt(const Profile *f, float t, float *p, float *v, float *a)
+{
+    float pp = 0.0f, vv = 0.0f, aa = 0.0f, dt;
+    int i;
+
+    if (t >= f->T) {
+        *p = f->p1;
+        *v = 0.0f;
+        *a = 0.0f;
+        return;
+    }
+    for (i = 0; i < 7 && t > 0.0f; i++) {
+        dt = t < f->seg[i] ? t : f->seg[i];
+        pp += (vv + (f->a0[i] / 2.0f + f->jerk[i] * dt / 6.0f) * dt) * dt;
+        vv += (f->a0[i] + f->jerk[i] * dt / 2.0f) * dt;
+        aa = f->a0[i] + f->jerk[i] * dt;
+        t -= dt;
+    }
+    *p = f->p0 + f->dir * pp;
+    *v = f->dir * vv;
+    *a = f->dir * aa;
+}
+
+/* Function to initialize velocity estimate at rest */
+void velInit(VelEst *v, int32_t p, uint32_t te, uint32_t now, uint32_t timeout)
+{
+    v->p = p;
+    v->te = te;
+    v->ts = now;
+    v->timeout = timeout;
+    v->vel = 0.0f;
+}
+
+/* Function to update velocity estimate [count/s] with the position and the time of the last edge, sampled at now */
+float velUpdate(VelEst *v, int32_t p, uint32_t te, uint32_t now)
+{
+    uint32_t dt;
+
+    if (p != v->p) {
+        /* Counts between the last edges of two samples; from rest, the edge before is stale */
+        /* and the counts are taken over the sampling period instead */
+        dt = v->vel == 0.0f ? now - v->ts : te - v->te;
+        if ((int32_t)dt <= 0) {
+            dt = 1;
+        }
+        v->vel = (float)(p - v->p) * 1e6f / dt;
+        v->p = p;
+        v->te = te;
+    }
+    else if (v->vel != 0.0f) {
+        /* No edge: the speed is lower than one count over the time since the last edge */
+        dt = now - v->te;
+        if (dt > v->timeout) {
+            v->vel = 0.0f;
+        }
+        else if (fabsf(v->vel) * dt > 1e6f) {
+            v->vel = copysignf(1e6f / dt, v->vel);
+        }
+    }
+    v->ts = now;
+    return v->vel;
+}
+
+/* Function to initialize cascaded loops from the identified model */
+/* lambda: speed loop time constant relative to the plant, as in piTune() */
+/* bw: position loop gain relative to the speed loop, 0.5 for a damping ratio of 0.7 */
+void servoInit(Servo *s, const Model *m, float lambda, float bw, unsigned cpr, float ts, float uMax, float tol)
+{
+    PiGain g;
+    Model mv = *m;
+    double tau = m->tau1 + 0.5 * m->tau2;
+
+    /* Velocity averaged over the sampling period lags by half a period */
+    mv.delay += 0.5 * ts;
+    piTune(&mv, ts, lambda, &g);
+    s->kp = g.kp;
+    s->ki = g.ki;
+
+    /* Closed-loop time constant plus dead time of the speed loop is tau / (kp K) by the SIMC rule */
+    s->kpp = (float)(bw * g.kp * m->K / tau);
+    s->kff = (float)(1.0 / m->K);
+    s->kaf = (float)((m->tau1 + m->tau2) / m->K);
+    s->rpc = 60.0f / cpr;
+    s->ts = ts;
+    s->uMax = uMax;
+    s->tol = tol;
+    s->integ = 0.0f;
+}
+
+/* Function to obtain modulation index, negative for reverse torque, at time t [s] of the profile */
+/* from the measured position [count] and velocity [count/s] */
+int servoUpdate(Servo *s, const Profile *f, float t, float pos, float vel)
+{
+    float pRef, vRef, aRef, e, wRef, ew, u;
+
+    /* At rest within the tolerance after the profile: zero voltage, the windings are shorted */
+    profileAt(f, t, &pRef, &vRef, &aRef);
+    e = pRef - pos;
+    if (t >= f->T && fabsf(e) <= s->tol) {
+        s->integ = 0.0f;
+        return 0;
+    }
+
+    /* Feed-forward from the middle of the sampling period, over which the output is held */
+    profileAt(f, t + 0.5f * s->ts, &pRef, &vRef, &aRef);
+
+    /* Speed reference [rpm] from the position loop and the profile */
+    wRef = (vRef + s->kpp * e) * s->rpc;
+    ew = wRef - vel * s->rpc;
+    u = s->kff * wRef + s->kaf * aRef * s->rpc + s->kp * ew + s->integ;
+
+    /* Integrate only while not saturated */
+    if (u > s->uMax) {
+        u = s->uMax;
+    }
+    else if (u < -s->uMax) {
+        u = -s->uMax;
+    }
+    else {
+        s->integ += s->ki * ew * s->ts;
+    }
+    return (int)u;
+}
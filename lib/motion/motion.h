@@ -0,0 +1,62 @@
+/*
+ * motion.h
+ * Point-to-point moves on the Hall-edge position counter
+ * Trapezoidal / S-curve (jerk-limited) move profile, velocity estimate from
+ * Hall edge timestamps (M/T method) and position loop cascaded on the speed PI
+ * Positions in counts of Hall edges, 6 * P_PAIR counts per revolution
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+#include "sysid.h"
+
+/* Move profile: 7 segments of jerk +J, 0, -J, 0, -J, 0, +J */
+/* With no jerk limit the jerk segments vanish and the profile is trapezoidal */
+typedef struct {
+    float p0;           /* [count] Start position */
+    float p1;           /* [count] Target position */
+    float dir;          /* +1 or -1 */
+    float T;            /* [s] Move time */
+    float vPeak;        /* [count/s] Peak speed actually reached */
+    float seg[7];       /* [s] Segment durations */
+    float a0[7];        /* [count/s^2] Acceleration at the segment start */
+    float jerk[7];      /* [count/s^3] Jerk within the segment */
+} Profile;
+
+/* Velocity estimate from the position and the time of the last counted edge */
+typedef struct {
+    int32_t p;          /* [count] Position at the last edge seen */
+    uint32_t te;        /* [microsecond] Time of the last edge seen */
+    uint32_t ts;        /* [microsecond] Time of the previous sample */
+    uint32_t timeout;   /* [microsecond] Velocity reads 0 if no edge for this long */
+    float vel;          /* [count/s] Estimate */
+} VelEst;
+
+/* Position P loop with feed-forward through the identified model, cascaded on the speed PI loop */
+/* The feed-forward carries the profile, so the speed PI is tuned tighter than for speed control */
+typedef struct {
+    float kpp;          /* [1/s] Position loop gain */
+    float kp;           /* [modulation unit / rpm] Speed proportional gain */
+    float ki;           /* [modulation unit / rpm / s] Speed integral gain */
+    float kff;          /* [modulation unit / rpm] Speed feed-forward, inverse of the static gain */
+    float kaf;          /* [modulation unit / (rpm/s)] Acceleration feed-forward, time constant over static gain */
+    float rpc;          /* [rpm] Speed of one count per second */
+    float ts;           /* [s] Sampling period */
+    float uMax;         /* Limit of the modulation index magnitude, unity = 1,000,000 */
+    float tol;          /* [count] Position error to hold at rest */
+    float integ;        /* Integral term */
+} Servo;
+
+/* Define function prototypes */
+void profileInit(Profile *f, float from, float to, float vMax, float aMax, float jMax);
+void profileAt(const Profile *f, float t, float *p, float *v, float *a);
+void velInit(VelEst *v, int32_t p, uint32_t te, uint32_t now, uint32_t timeout);
+float velUpdate(VelEst *v, int32_t p, uint32_t te, uint32_t now);
+void servoInit(Servo *s, const Model *m, float lambda, float bw, unsigned cpr, float ts, float uMax, float tol);
+int servoUpdate(Servo *s, const Profile *f, float t, float pos, float vel);
+
+#endif /* MOTION_H */
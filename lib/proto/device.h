@@ -0,0 +1,32 @@
+/*
+ * device.h
+ * Values of the motor drive seen on the binary protocol: serial settings,
+ * motor status, drive and stop modes and their limits
+ * Included by the firmware and the host programs that serve or simulate it
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#ifndef DEVICE_H
+#define DEVICE_H
+
+/* Define binary protocol parameters */
+#define BAUD    921600  /* [bit/s] Serial, shared by the text console */
+#define MB_ADDR 1       /* Own address, never a text command character */
+#define MB_GAP  1750    /* [microsecond] Silence that drops a partial frame, t3.5 above 19200 bit/s */
+
+/* Motor status */
+#define STILL   0
+#define RUNNING 1
+
+/* Drive modes: switches of the chopped phase during PWM off-time */
+#define DRV_SYNC    0   /* Synchronous rectification: IN chopped, low side on */
+#define DRV_ASYNC   1   /* Diode freewheeling: EN chopped, both switches off */
+#define DT_MAX  10      /* [tick] Maximum additional dead time */
+
+/* Stop modes */
+#define STOP_COAST  0   /* Gate block and coast */
+#define STOP_BRAKE  1   /* Short windings through low sides, current limited */
+#define STOP_REGEN  2   /* Regenerative decel to STOP_RPM, then brake */
+
+#endif /* DEVICE_H */
@@ -0,0 +1,261 @@
+/*
+ * proto.cpp
+ * Binary request/response protocol on the serial console, subset of Modbus RTU
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#include "proto.h"
+
+/* Define function prototypes, local */
+static unsigned protoExec(Proto *p, uint8_t *out);
+static unsigned putCrc(uint8_t *b, unsigned len);
+
+/* Function to initialize protocol engine */
+void protoInit(Proto *p, uint8_t addr, uint32_t gap, ProtoRead rd, ProtoWrite wr, ProtoCheck chk)
+{
+    p->addr = addr;
+    p->gap = gap;
+    p->read = rd;
+    p->write = wr;
+    p->check = chk;
+    p->len = 0;
+    p->need = 0;
+    p->skip = 0;
+    p->tLast = 0;
+    p->frames = 0;
+    p->errors = 0;
+}
+
+/* Function to end a frame in progress after a silence of gap at time now [microsecond] */
+/* A frame of an unsupported function code with a valid CRC gets exception EX_FUNCTION into out, */
+/* dropped as other partial frames if out is 0; to be polled while no byte comes */
+/* Returns length of the response put into out, 0 if none */
+int protoIdle(Proto *p, uint32_t now, uint8_t *out)
+{
+    const uint8_t *b = p->buf;
+    unsigned len = p->len;
+    int n = 0;
+
+    if (!protoBusy(p) || now - p->tLast <= p->gap) {
+        return 0;
+    }
+    p->len = 0;
+    p->skip = 0;
+    if (out != 0 && p->need == 0 && len >= 4 && b[1] != FC_WRITE_MULTI &&
+        crc16(b, len - 2) == (b[len - 2] | (b[len - 1] << 8))) {
+        p->frames++;
+        if (b[0] != PROTO_BCAST) {
+            out[0] = b[0];
+            out[1] = b[1] | 0x80;
+            out[2] = EX_FUNCTION;
+            n = (int)putCrc(out, 3);
+        }
+    }
+    else if (len > 0) {
+        p->errors++;
+    }
+    return n;
+}
+
+/* Function to obtain whether a frame is in progress, to be called after protoIdle() */
+int protoBusy(const Proto *p)
+{
+    return p->len > 0 || p->skip;
+}
+
+/* Function to feed one received byte at time now [microsecond] */
+/* Returns length of the response put into out, 0 if none (yet), -1 if the byte is not part of a frame */
+int protoFeed(Proto *p, uint8_t c, uint32_t now, uint8_t *out)
+{
+    /* Silence ends a frame in progress, not answered here as the byte may belong to the text console */
+    protoIdle(p, now, 0);
+    p->tLast = now;
+    if (p->skip) {
+        return 0;
+    }
+
+    /* A frame starts with the address */
+    if (p->len == 0) {
+        if (c != p->addr && c != PROTO_BCAST) {
+            return -1;
+        }
+        p->need = 0;
+    }
+    p->buf[p->len++] = c;
+
+    /* Length from function code, and from byte count for multiple registers, */
+    /* unknown for an unsupported function code: kept until the gap, up to the buffer size */
+    if (p->len == 2) {
+        switch (c) {
+            case FC_READ_HOLD:
+            case FC_READ_INPUT:
+            case FC_WRITE_ONE:
+                p->need = 8;
+                break;
+        }
+    }
+    else if (p->len == 7 && p->buf[1] == FC_WRITE_MULTI) {
+        p->need = 9 + c;
+        if (p->need > PROTO_MAX) {
+            p->errors++;
+            p->len = 0;
+            p->skip = 1;
+            return 0;
+        }
+    }
+    if (p->need == 0 && p->len == PROTO_MAX) {
+        p->errors++;
+        p->len = 0;
+        p->skip = 1;
+        return 0;
+    }
+    if (p->need == 0 || p->len < p->need) {
+        return 0;
+    }
+
+    /* Complete frame */
+    p->len = 0;
+    if (crc16(p->buf, p->need - 2) != (p->buf[p->need - 2] | (p->buf[p->need - 1] << 8))) {
+        p->errors++;
+        return 0;
+    }
+    p->frames++;
+    return (int)protoExec(p, out);
+}
+
+/* Function to execute a request, returns length of the response, 0 for broadcast */
+static unsigned protoExec(Proto *p, uint8_t *out)
+{
+    const uint8_t *b = p->buf;
+    uint16_t reg = (b[2] << 8) | b[3];
+    uint16_t n = (b[4] << 8) | b[5];
+    uint16_t val;
+    unsigned i, len = 6;
+    int ex = 0;
+
+    out[0] = b[0];
+    out[1] = b[1];
+    switch (b[1]) {
+        case FC_READ_HOLD:
+        case FC_READ_INPUT:
+            if (n < 1 || n > 125) {
+                ex = EX_VALUE;
+                break;
+            }
+            out[2] = (uint8_t)(2 * n);
+            for (i = 0; i < n && ex == 0; i++) {
+                ex = p->read(b[1] == FC_READ_HOLD ? REG_HOLD : REG_INPUT, reg + i, &val);
+                out[3 + 2 * i] = val >> 8;
+                out[4 + 2 * i] = val & 0xFF;
+            }
+            len = 3 + 2 * n;
+            break;
+
+        case FC_WRITE_ONE:
+            ex = p->write(reg, n);
+            break;
+
+        case FC_WRITE_MULTI:
+            if (n < 1 || n > 123 || b[6] != 2 * n) {
+                ex = EX_VALUE;
+                break;
+            }
+            /* All or nothing: every address and value checked before the first write */
+            for (i = 0; i < n && ex == 0; i++) {
+                ex = p->check(reg + i, (b[7 + 2 * i] << 8) | b[8 + 2 * i]);
+            }
+            for (i = 0; i < n && ex == 0; i++) {
+                ex = p->write(reg + i, (b[7 + 2 * i] << 8) | b[8 + 2 * i]);
+            }
+            break;
+    }
+
+    /* Writes echo address and value or count */
+    if (ex == 0 && b[1] != FC_READ_HOLD && b[1] != FC_READ_INPUT) {
+        for (i = 2; i < 6; i++) {
+            out[i] = b[i];
+        }
+    }
+    if (ex != 0) {
+        out[1] |= 0x80;
+        out[2] = (uint8_t)ex;
+        len = 3;
+    }
+    if (b[0] == PROTO_BCAST) {
+        return 0;
+    }
+    return putCrc(out, len);
+}
+
+/* Function to obtain CRC-16 of Modbus */
+uint16_t crc16(const uint8_t *d, unsigned n)
+{
+    uint16_t crc = 0xFFFF;
+    unsigned i, j;
+
+    for (i = 0; i < n; i++) {
+        crc ^= d[i];
+        for (j = 0; j < 8; j++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+/* Function to append CRC, returns frame length */
+static unsigned putCrc(uint8_t *b, unsigned len)
+{
+    uint16_t crc = crc16(b, len);
+
+    b[len] = crc & 0xFF;
+    b[len + 1] = crc >> 8;
+    return len + 2;
+}
+
+/* Function to build a read request, returns frame length */
+unsigned protoReadReq(uint8_t *out, uint8_t addr, uint8_t fc, uint16_t reg, uint16_t n)
+{
+    out[0] = addr;
+    out[1] = fc;
+    out[2] = reg >> 8;
+    out[3] = reg & 0xFF;
+    out[4] = n >> 8;
+    out[5] = n & 0xFF;
+    return putCrc(out, 6);
+}
+
+/* Function to build a single register write request, returns frame length */
+unsigned protoWriteReq(uint8_t *out, uint8_t addr, uint16_t reg, uint16_t val)
+{
+    return protoReadReq(out, addr, FC_WRITE_ONE, reg, val);
+}
+
+/* Function to build a multiple register write request, returns frame length */
+unsigned protoWriteMultiReq(uint8_t *out, uint8_t addr, uint16_t reg, uint16_t n, const uint16_t *val)
+{
+    unsigned i;
+
+    protoReadReq(out, addr, FC_WRITE_MULTI, reg, n);
+    out[6] = (uint8_t)(2 * n);
+    for (i = 0; i < n; i++) {
+        out[7 + 2 * i] = val[i] >> 8;
+        out[8 + 2 * i] = val[i] & 0xFF;
+    }
+    return putCrc(out, 7 + 2 * n);
+}
+
+/* Function to obtain length of a response from its first bytes, 0 while not known yet */
+unsigned protoRespLen(const uint8_t *b, unsigned len)
+{
+    if (len < 3) {
+        return 0;
+    }
+    if (b[1] & 0x80) {
+        return 5;
+    }
+    if (b[1] == FC_READ_HOLD || b[1] == FC_READ_INPUT) {
+        return 5 + b[2];
+    }
+    return 8;
+}
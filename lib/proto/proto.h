@@ -0,0 +1,71 @@
+/*
+ * proto.h
+ * Binary request/response protocol on the serial console, subset of Modbus RTU
+ * Read holding/input registers (0x03/0x04), write single/multiple registers (0x06/0x10),
+ * CRC-16 (polynomial 0xA001 reflected, initial 0xFFFF, low byte first)
+ * Frames are delimited by their length from the function code, a silence of gap drops
+ * a partial frame, so that requests can be streamed back to back
+ * A frame of an unsupported function code is delimited by the gap and gets exception EX_FUNCTION
+ * Writes of multiple registers are checked as a whole before any register is written
+ * A byte other than the own or broadcast address outside a frame is left to the text console
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+
+/* Define frame parameters */
+#define PROTO_MAX   256     /* Maximum frame length of Modbus RTU */
+#define PROTO_BCAST 0       /* Broadcast address, executed without response */
+
+/* Function codes */
+#define FC_READ_HOLD    0x03
+#define FC_READ_INPUT   0x04
+#define FC_WRITE_ONE    0x06
+#define FC_WRITE_MULTI  0x10
+
+/* Exception codes */
+#define EX_FUNCTION 0x01    /* Illegal function */
+#define EX_ADDRESS  0x02    /* Illegal data address */
+#define EX_VALUE    0x03    /* Illegal data value */
+
+/* Register types */
+#define REG_HOLD    0       /* Holding registers, read/write */
+#define REG_INPUT   1       /* Input registers, read only */
+
+/* Register access, return 0 or an exception code */
+typedef int (*ProtoRead)(int type, uint16_t reg, uint16_t *val);
+typedef int (*ProtoWrite)(uint16_t reg, uint16_t val);
+typedef int (*ProtoCheck)(uint16_t reg, uint16_t val);     /* Same result as ProtoWrite, writes nothing */
+
+/* Protocol engine */
+typedef struct {
+    uint8_t addr;               /* Own address, 1-247 */
+    uint32_t gap;               /* [microsecond] Silence that drops a partial frame */
+    ProtoRead read;             /* Register read function */
+    ProtoWrite write;           /* Register write function */
+    ProtoCheck check;           /* Register write check function */
+    uint8_t buf[PROTO_MAX];     /* Frame being received */
+    unsigned len;               /* Bytes received */
+    unsigned need;              /* Frame length, 0 while not known yet */
+    int skip;                   /* Flag to discard bytes of a frame of unknown length until the gap */
+    uint32_t tLast;             /* [microsecond] Time of the last byte */
+    unsigned frames;            /* Frames executed */
+    unsigned errors;            /* Frames dropped for CRC, length or function code */
+} Proto;
+
+/* Define function prototypes */
+void protoInit(Proto *p, uint8_t addr, uint32_t gap, ProtoRead rd, ProtoWrite wr, ProtoCheck chk);
+int protoIdle(Proto *p, uint32_t now, uint8_t *out);
+int protoBusy(const Proto *p);
+int protoFeed(Proto *p, uint8_t c, uint32_t now, uint8_t *out);
+uint16_t crc16(const uint8_t *d, unsigned n);
+unsigned protoReadReq(uint8_t *out, uint8_t addr, uint8_t fc, uint16_t reg, uint16_t n);
+unsigned protoWriteReq(uint8_t *out, uint8_t addr, uint16_t reg, uint16_t val);
+unsigned protoWriteMultiReq(uint8_t *out, uint8_t addr, uint16_t reg, uint16_t n, const uint16_t *val);
+unsigned protoRespLen(const uint8_t *b, unsigned len);
+
+#endif /* PROTO_H */
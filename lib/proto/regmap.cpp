@@ -0,0 +1,95 @@
+/*
+ * regmap.cpp
+ * Register map of the motor drive on the binary protocol
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#include "proto.h"
+#include "regmap.h"
+
+/* Function to read a register, returns 0 or an exception code */
+int regRead(RegDev *d, int type, uint16_t reg, uint16_t *val)
+{
+    if (type == REG_HOLD) {
+        switch (reg) {
+            case HR_CMD:  *val = 0; return 0;
+            case HR_MOD:  *val = *d->mod / REG_MOD_DIV; return 0;
+            case HR_DRV:  *val = *d->drv; return 0;
+            case HR_DEAD: *val = *d->dead; return 0;
+            case HR_STOP: *val = *d->stp; return 0;
+        }
+        return EX_ADDRESS;
+    }
+    switch (reg) {
+        case IR_STAT: *val = *d->st; return 0;
+        case IR_RPM:  *val = (uint16_t)d->speed(); return 0;
+        case IR_POSH: d->posLatch = *d->pos; *val = (uint32_t)d->posLatch >> 16; return 0;
+        case IR_POSL: *val = (uint32_t)d->posLatch & 0xFFFF; return 0;
+        case IR_SEC:  *val = *d->sec; return 0;
+    }
+    return EX_ADDRESS;
+}
+
+/* Function to check a register write without writing, returns 0 or an exception code as regWrite() */
+int regCheck(RegDev *d, uint16_t reg, uint16_t val)
+{
+    switch (reg) {
+        case HR_CMD:
+            return val == CMD_START || val == CMD_STOP || val == CMD_ZERO ? 0 : EX_VALUE;
+
+        case HR_MOD:
+            return val > REG_MOD_MAX ? EX_VALUE : 0;
+
+        case HR_DRV:
+            return val > d->drvMax ? EX_VALUE : 0;
+
+        case HR_DEAD:
+            return val > d->deadMax ? EX_VALUE : 0;
+
+        case HR_STOP:
+            return val > d->stpMax ? EX_VALUE : 0;
+    }
+    return EX_ADDRESS;
+}
+
+/* Function to write a register, returns 0 or an exception code */
+/* Start and stop set the status only, the modulation index takes effect at the next Hall edge */
+int regWrite(RegDev *d, uint16_t reg, uint16_t val)
+{
+    int ex = regCheck(d, reg, val);
+
+    if (ex != 0) {
+        return ex;
+    }
+    switch (reg) {
+        case HR_CMD:
+            if (val == CMD_START) {
+                *d->st = d->running;
+            }
+            else if (val == CMD_STOP) {
+                *d->st = d->still;
+            }
+            else {
+                *d->pos = 0;
+            }
+            break;
+
+        case HR_MOD:
+            *d->mod = val * REG_MOD_DIV;
+            break;
+
+        case HR_DRV:
+            *d->drv = val;
+            break;
+
+        case HR_DEAD:
+            *d->dead = val;
+            break;
+
+        case HR_STOP:
+            *d->stp = val;
+            break;
+    }
+    return 0;
+}
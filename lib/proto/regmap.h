@@ -0,0 +1,58 @@
+/*
+ * regmap.h
+ * Register map of the motor drive on the binary protocol
+ * Works on pointers to the device variables, so that the firmware and the host
+ * test harness serve the same registers with the same checks
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#ifndef REGMAP_H
+#define REGMAP_H
+
+#include <stdint.h>
+
+/* Holding registers */
+#define HR_CMD  0       /* Command: CMD_START, CMD_STOP, CMD_ZERO, reads 0 */
+#define HR_MOD  1       /* Modulation index, unity = 10,000 */
+#define HR_DRV  2       /* Drive mode: DRV_SYNC, DRV_ASYNC */
+#define HR_DEAD 3       /* [tick] Additional dead time, up to DT_MAX */
+#define HR_STOP 4       /* Stop mode: STOP_COAST, STOP_BRAKE, STOP_REGEN */
+
+/* Input registers */
+#define IR_STAT 0       /* Motor status: STILL, RUNNING */
+#define IR_RPM  1       /* [rpm] Rotational speed */
+#define IR_POSH 2       /* [count] Position, high word, latches the low word */
+#define IR_POSL 3       /* [count] Position, low word as latched */
+#define IR_SEC  4       /* Sector of Hall sensor signals, 0 = unknown */
+
+/* Commands by HR_CMD */
+#define CMD_START   1
+#define CMD_STOP    2
+#define CMD_ZERO    3
+
+/* Define register parameters */
+#define REG_MOD_MAX 10000   /* Unity of HR_MOD */
+#define REG_MOD_DIV 100     /* Modulation index per unit of HR_MOD */
+
+/* Device variables behind the registers */
+typedef struct {
+    volatile int *st;           /* Motor status */
+    volatile int *mod;          /* Modulation index: Note unity = 1,000,000 */
+    volatile int *drv;          /* Drive mode */
+    volatile int *dead;         /* [tick] Additional dead time */
+    volatile int *stp;          /* Stop mode */
+    volatile int32_t *pos;      /* [count] Position */
+    volatile unsigned *sec;     /* Sector of the last Hall edge */
+    float (*speed)();           /* Function to obtain rotational speed [rpm] */
+    int still, running;         /* Values of the motor status */
+    int drvMax, deadMax, stpMax;    /* Largest values of the drive mode, dead time and stop mode */
+    int32_t posLatch;           /* [count] Position latched by reading IR_POSH */
+} RegDev;
+
+/* Define function prototypes */
+int regRead(RegDev *d, int type, uint16_t reg, uint16_t *val);
+int regCheck(RegDev *d, uint16_t reg, uint16_t val);
+int regWrite(RegDev *d, uint16_t reg, uint16_t val);
+
+#endif /* REGMAP_H */
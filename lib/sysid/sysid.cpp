@@ -0,0 +1,259 @@
+/*
+ * sysid.cpp
+ * On-line system identification of the speed response and PI gain design
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#include <math.h>
+#include "sysid.h"
+
+/* Define identification parameters */
+#define RLS_P0      1e6     /* Initial covariance, large for an uninformed start */
+#define SEL_RATIO   0.8     /* 2nd order is chosen only if it cuts the error sum by 20% */
+
+/* Function to initialize excitation generator */
+void exciteInit(Excite *e, int type, int amp, unsigned hold)
+{
+    e->type = type;
+    e->amp = amp;
+    e->hold = hold > 0 ? hold : 1;
+    e->count = 0;
+    e->lfsr = 0x7F;
+    e->level = 0;
+}
+
+/* Function to obtain next excitation sample */
+int exciteNext(Excite *e)
+{
+    unsigned bit;
+
+    switch (e->type) {
+        case EXC_PRBS:  /* x^7 + x^6 + 1, maximum length 127 */
+            if (e->count % e->hold == 0) {
+                bit = ((e->lfsr >> 6) ^ (e->lfsr >> 5)) & 1;
+                e->lfsr = ((e->lfsr << 1) | bit) & 0x7F;
+                e->level = (e->lfsr & 1) ? e->amp : -e->amp;
+            }
+            break;
+
+        case EXC_STEP:
+            e->level = e->count < e->hold ? 0 : e->amp;
+            break;
+    }
+    e->count++;
+    return e->level;
+}
+
+/* Function to initialize RLS estimator */
+void rlsInit(Rls *r, int order, double lambda)
+{
+    int i, j;
+
+    r->order = order == 2 ? 2 : 1;
+    r->n = r->order == 2 ? 5 : 4;
+    r->lambda = lambda;
+    for (i = 0; i < RLS_MAX; i++) {
+        r->theta[i] = 0.0;
+        for (j = 0; j < RLS_MAX; j++) {
+            r->P[i][j] = i == j ? RLS_P0 : 0.0;
+        }
+    }
+    r->y1 = r->y2 = r->u1 = r->u2 = 0.0;
+    r->sse = 0.0;
+    r->count = 0;
+}
+
+/* Function to update RLS estimator with output y[k] and the input u[k] applied from now on */
+void rlsUpdate(Rls *r, double u, double y)
+{
+    double phi[RLS_MAX], Pphi[RLS_MAX], gain[RLS_MAX];
+    double e, den;
+    int i, j, n = r->n;
+
+    /* Regressor */
+    if (r->order == 2) {
+        phi[0] = r->y1;
+        phi[1] = r->y2;
+        phi[2] = r->u1;
+        phi[3] = r->u2;
+        phi[4] = 1.0;
+    }
+    else {
+        phi[0] = r->y1;
+        phi[1] = r->u1;
+        phi[2] = r->u2;
+        phi[3] = 1.0;
+    }
+
+    /* Update only after the history is filled */
+    if (r->count >= 2) {
+        /* A priori error */
+        e = y;
+        for (i = 0; i < n; i++) {
+            e -= r->theta[i] * phi[i];
+        }
+
+        /* Gain vector */
+        den = r->lambda;
+        for (i = 0; i < n; i++) {
+            Pphi[i] = 0.0;
+            for (j = 0; j < n; j++) {
+                Pphi[i] += r->P[i][j] * phi[j];
+            }
+            den += phi[i] * Pphi[i];
+        }
+        for (i = 0; i < n; i++) {
+            gain[i] = Pphi[i] / den;
+            r->theta[i] += gain[i] * e;
+        }
+
+        /* Covariance, kept symmetric */
+        for (i = 0; i < n; i++) {
+            for (j = i; j < n; j++) {
+                r->P[i][j] = (r->P[i][j] - gain[i] * Pphi[j]) / r->lambda;
+                r->P[j][i] = r->P[i][j];
+            }
+        }
+
+        /* Skip the initial transient of the estimate in the error sum */
+        if (r->count >= (unsigned)(4 * n)) {
+            r->sse += e * e;
+        }
+    }
+
+    /* Shift history */
+    r->y2 = r->y1;
+    r->y1 = y;
+    r->u2 = r->u1;
+    r->u1 = u;
+    r->count++;
+}
+
+/* Function to convert RLS estimate into a continuous-time model, returns -1 if not a stable real-pole plant */
+int rlsModel(const Rls *r, double ts, Model *m)
+{
+    double a1, a2, b, disc, z1, z2, t;
+
+    m->order = r->order;
+    if (r->order == 1) {
+        a1 = r->theta[0];
+        b = r->theta[1] + r->theta[2];
+        if (a1 <= 0.0 || a1 >= 1.0 || b == 0.0) {
+            return -1;
+        }
+        m->K = b / (1.0 - a1);
+        m->tau1 = -ts / log(a1);
+        m->tau2 = 0.0;
+
+        /* Share of the input arriving one sample late, clipped to one sample */
+        t = r->theta[2] / b;
+        m->delay = (t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t)) * ts;
+        return 0;
+    }
+
+    a1 = r->theta[0];
+    a2 = r->theta[1];
+    b = r->theta[2] + r->theta[3];
+    disc = a1 * a1 + 4.0 * a2;
+    if (disc < 0.0) {
+        return -1;
+    }
+    z1 = 0.5 * (a1 + sqrt(disc));
+    z2 = 0.5 * (a1 - sqrt(disc));
+    if (z1 <= 0.0 || z1 >= 1.0 || z2 <= 0.0 || z2 >= 1.0) {
+        return -1;
+    }
+    m->K = b / (1.0 - a1 - a2);
+    m->tau1 = -ts / log(z1);
+    m->tau2 = -ts / log(z2);
+    m->delay = 0.0;
+    if (m->tau2 > m->tau1) {
+        t = m->tau1;
+        m->tau1 = m->tau2;
+        m->tau2 = t;
+    }
+    return 0;
+}
+
+/* Function to choose between 1st- and 2nd-order estimates, returns NULL if neither is usable */
+const Rls *rlsSelect(const Rls *r1, const Rls *r2)
+{
+    Model m;
+    int ok1 = rlsModel(r1, 1.0, &m) == 0;
+    int ok2 = rlsModel(r2, 1.0, &m) == 0;
+
+    if (ok2 && (!ok1 || r2->sse < SEL_RATIO * r1->sse)) {
+        return r2;
+    }
+    return ok1 ? r1 : 0;
+}
+
+/* Function to initialize identification at input u0 and output y0 of the operating point */
+void identInit(Ident *d, int type, int amp, unsigned hold, int u0, int uMax, double y0)
+{
+    exciteInit(&d->exc, type, amp, hold);
+    rlsInit(&d->r1, 1, 1.0);
+    rlsInit(&d->r2, 2, 1.0);
+    d->u0 = u0;
+    d->uMax = uMax;
+    d->y0 = y0;
+}
+
+/* Function to take output sample y and obtain the input to apply until the next sample */
+/* Returns the input clipped to 0 - uMax, -1 if the output is 0 (stalled) */
+int identStep(Ident *d, double y)
+{
+    int u;
+
+    if (y == 0.0) {
+        return -1;
+    }
+    u = d->u0 + exciteNext(&d->exc);
+    if (u > d->uMax) {
+        u = d->uMax;
+    }
+    if (u < 0) {
+        u = 0;
+    }
+
+    /* Input normalized to the excitation amplitude to keep the covariance well conditioned */
+    rlsUpdate(&d->r1, (double)(u - d->u0) / d->exc.amp, y - d->y0);
+    rlsUpdate(&d->r2, (double)(u - d->u0) / d->exc.amp, y - d->y0);
+    return u;
+}
+
+/* Function to obtain the model chosen at the end of identification, gain in [output unit / input unit] */
+/* Returns 0 on success, -1 if no stable model with a positive gain is fitted */
+int identModel(const Ident *d, double ts, Model *m)
+{
+    const Rls *r = rlsSelect(&d->r1, &d->r2);
+
+    if (r == 0 || rlsModel(r, ts, m) < 0 || m->K <= 0.0) {
+        return -1;
+    }
+    m->K /= d->exc.amp;
+    return 0;
+}
+
+/* Function to design PI gains by the SIMC rule */
+/* lambda: desired closed-loop time constant relative to the plant time constant */
+void piTune(const Model *m, double ts, double lambda, PiGain *g)
+{
+    /* Half rule: 2nd-order plant approximated by 1st order plus dead time, */
+    /* the zero-order hold of the sampled controller adds half a sample */
+    double tau = m->tau1 + 0.5 * m->tau2;
+    double theta = 0.5 * m->tau2 + m->delay + 0.5 * ts;
+    double tc = lambda * tau;
+    double ti;
+
+    if (tc < theta) {
+        tc = theta;
+    }
+    ti = 4.0 * (tc + theta);
+    if (ti > tau) {
+        ti = tau;
+    }
+    g->kp = (float)(tau / (m->K * (tc + theta)));
+    g->ki = (float)(g->kp / ti);
+}
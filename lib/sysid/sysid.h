@@ -0,0 +1,84 @@
+/*
+ * sysid.h
+ * On-line system identification of the speed response and PI gain design
+ * Excitation (PRBS or step), recursive least squares fit of a 1st/2nd-order
+ * ARX model, conversion to continuous time and SIMC PI tuning
+ * The 1st-order model carries a second input term to absorb a fractional dead time,
+ * e.g. the lag of the speed measured from one electrical period of Hall edges
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#ifndef SYSID_H
+#define SYSID_H
+
+#include <stdint.h>
+
+/* Excitation types */
+#define EXC_PRBS    0   /* Pseudo random binary sequence, 7-bit LFSR, period 127 bits */
+#define EXC_STEP    1   /* Single step after a quarter of the record */
+
+/* Maximum number of estimated parameters: a1, a2, b1, b2, c */
+#define RLS_MAX     5
+
+/* Excitation generator */
+typedef struct {
+    int type;           /* EXC_PRBS or EXC_STEP */
+    int amp;            /* Amplitude added to the operating point */
+    unsigned hold;      /* Samples per PRBS bit / samples before the step */
+    unsigned count;     /* Samples generated so far */
+    unsigned lfsr;      /* LFSR state */
+    int level;          /* Current output */
+} Excite;
+
+/* Recursive least squares estimator of */
+/* 1st order: y[k] = a1 y[k-1] + b1 u[k-1] + b2 u[k-2] + c */
+/* 2nd order: y[k] = a1 y[k-1] + a2 y[k-2] + b1 u[k-1] + b2 u[k-2] + c */
+typedef struct {
+    int order;                  /* Model order, 1 or 2 */
+    int n;                      /* Number of parameters */
+    double lambda;              /* Forgetting factor, 1.0 = none */
+    double theta[RLS_MAX];      /* Parameter estimate */
+    double P[RLS_MAX][RLS_MAX]; /* Covariance matrix */
+    double y1, y2, u1, u2;      /* Regressor history */
+    double sse;                 /* Sum of squared a priori errors */
+    unsigned count;             /* Number of updates */
+} Rls;
+
+/* Continuous-time model: K exp(-delay s) / ((1 + tau1 s)(1 + tau2 s)) */
+typedef struct {
+    int order;          /* 1 or 2 */
+    double K;           /* Static gain, [output unit / input unit] */
+    double tau1;        /* [s] Dominant time constant */
+    double tau2;        /* [s] Second time constant, 0 for 1st order */
+    double delay;       /* [s] Dead time within one sample, 0 for 2nd order */
+} Model;
+
+/* Identification sequence around an operating point: excitation and both model orders */
+typedef struct {
+    Excite exc;         /* Excitation generator, amplitude normalizes the input */
+    Rls r1, r2;         /* 1st- and 2nd-order estimators */
+    int u0;             /* Input at the operating point */
+    int uMax;           /* Largest input, the smallest is 0 */
+    double y0;          /* Output at the operating point */
+} Ident;
+
+/* PI gains, u = kp * e + ki * integral(e) */
+typedef struct {
+    float kp;           /* [input unit / output unit] */
+    float ki;           /* [input unit / output unit / s] */
+} PiGain;
+
+/* Define function prototypes */
+void exciteInit(Excite *e, int type, int amp, unsigned hold);
+int exciteNext(Excite *e);
+void rlsInit(Rls *r, int order, double lambda);
+void rlsUpdate(Rls *r, double u, double y);
+int rlsModel(const Rls *r, double ts, Model *m);
+const Rls *rlsSelect(const Rls *r1, const Rls *r2);
+void identInit(Ident *d, int type, int amp, unsigned hold, int u0, int uMax, double y0);
+int identStep(Ident *d, double y);
+int identModel(const Ident *d, double ts, Model *m);
+void piTune(const Model *m, double ts, double lambda, PiGain *g);
+
+#endif /* SYSID_H */
@@ -8,6 +8,17 @@
  */
 
 #include <M5Stack.h>
+#include <Preferences.h>
+#include <driver/ledc.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include "sysid.h"
+#include "motion.h"
+#include "proto.h"
+#include "device.h"
+#include "regmap.h"
 
 /* Define motor and drive parameter */
 #define P_PAIR  7       /* Number of pole pairs */
@@ -20,6 +31,45 @@
 #define CHKDLY  50000   /* [microsecond] to wait to check the callback function takes over control */
 #define MAF     540     /* Moving average filter to count revolution */
 
+/* Define auto-tuning parameters */
+#define TS_ID   20000   /* [microsecond] Sampling period of identification */
+#define HOLD_ID 5       /* Samples per PRBS bit */
+#define N_ID    1270    /* Number of identification samples: two PRBS periods */
+#define SET_ID  50      /* Samples to settle at the operating point before excitation */
+#define A_ID    60000   /* Excitation amplitude of modulation index: Note unity = 1,000,000 */
+#define LAM_ID  1.0     /* Closed-loop time constant relative to the identified plant */
+
+/* Define drive and stop mode parameters */
+#define PWM_MAX 255     /* Full duty of 8-bit PWM */
+#define PWM_TOP 256     /* [tick] PWM period: one tick = 1 / (F_PWM * 256), 195 ns at 20 kHz */
+#define RG_MAR  100000  /* Applied voltage below back-EMF in regenerative decel: Note unity = 1,000,000 */
+#define BK_MAR  100000  /* Voltage left across the windings in braking, of DC link voltage: Note unity = 1,000,000 */
+#define STOP_RPM 100    /* [rpm] Speed to finish active decel */
+#define T_STOP  5000000 /* [microsecond] Timeout of active decel */
+#define BK_SETL 200000  /* [microsecond] Time without a Hall edge to release the brake at standstill */
+
+/* Define move parameters */
+#define CPR     (6 * P_PAIR)    /* [count] Hall edges per revolution */
+#define MV_IDX  CPR     /* [count] Distance of one indexed move */
+#define MV_RPM  600     /* [rpm] Speed limit of moves */
+#define MV_ACC  6000    /* [rpm/s] Acceleration limit of moves */
+#define MV_JRK  60000   /* [rpm/s^2] Jerk limit of S-curve moves */
+#define MV_LAM  0.2     /* Speed loop time constant of moves relative to the identified plant */
+#define MV_BW   0.5     /* Position loop gain relative to the speed loop */
+#define MV_TOL  1       /* [count] Position tolerance to finish a move */
+#define T_SETL  1000000 /* [microsecond] Time allowed to settle after the profile ends */
+
+/* Define idle power management parameters */
+#define IDLE_T  5000000 /* [microsecond] Time without input at standstill before light sleep */
+#define MB_AWAKE 60000000   /* [microsecond] Time to stay awake after a binary frame: requests of a master */
+                            /* polling at least this often never meet a sleeping console */
+#define WAKE_EDGE 3     /* Rising edges on RXD to wake from light sleep: '\n' has 3, the waking byte is lost */
+#define WAKE_MAX 2000   /* [microsecond] Guaranteed wake latency, to wait after the waking byte */
+#define N_WAKE  20      /* Number of wake latency measurements */
+#define T_WAKE  10000   /* [microsecond] Timed light sleep of one measurement */
+#define I_ACT   50.0    /* [mA] ESP32 busy polling at 240 MHz, radio off: datasheet estimate */
+#define I_SLEEP 0.8     /* [mA] ESP32 in light sleep: datasheet estimate */
+
 /* Define GPIO pins connected to P-NUCLEO-IHM001 */
 /* Hall sensors */
 /* Note: H1, H2, and H3 becomes 1 (high) when they detect a south pole. */
@@ -43,6 +93,12 @@
 #define IN2PWM  2
 #define IN3PWM  4
 
+/* PWM channels of enable (deblock) signals */
+/* Channel 2n+1 shares the timer of channel 2n, so EN is phase-aligned with IN */
+#define EN1PWM  1
+#define EN2PWM  3
+#define EN3PWM  5
+
 /* Sector 1 signal */
 #define SEC1    25
 
@@ -50,29 +106,81 @@
  int GB =  0x0;
  int DEB = 0x1;
 
-/* Motor status */
-#define STILL   0
-#define RUNNING 1
+/* Phase states */
+#define PH_OFF  0       /* Both switches off */
+#define PH_LOW  1       /* Low side on */
+#define PH_PWM  2       /* Chopped by PWM */
+
+/* Move profiles */
+#define PRF_TRAP    0   /* Trapezoidal speed, acceleration limited */
+#define PRF_SCURVE  1   /* S-curve speed, jerk limited */
 
 /* Define pigpio parameters */
 #define TIMEOUT 100000
 
 /* Define global variables */
 int st = STILL;         /* Enable (deblock) status */
-int mod = 0;            /* Modulation index */
-int called = 0;         /* Flag to indicate the callback function being called */
-uint32_t tick_0 = 0;    /* [microsecond] for one electrical cycle */
-uint32_t tick_1 = 0;    /* [microsecond] for one electrical cycle, old value */
-uint32_t tick_diff[MAF];/* Tick difference buffer */
-int k = 0;              /* Index for tick difference buffer */
+volatile int mod = 0;   /* Modulation index */
+volatile int called = 0;/* Flag to indicate the callback function being called */
+volatile uint32_t tick_0 = 0;   /* [microsecond] for one electrical cycle */
+volatile uint32_t tick_1 = 0;   /* [microsecond] for one electrical cycle, old value */
+volatile uint32_t tick_diff[MAF];/* Tick difference buffer */
+volatile int k = 0;     /* Index for tick difference buffer */
+volatile int drv = DRV_SYNC;    /* Drive mode */
+volatile int dead = 0;  /* [tick] Additional dead time after high side turns off */
+volatile int comm = 0;  /* Flag to let the callback function commutate */
+volatile int rev = 0;   /* Flag to apply torque in reverse: sectors shifted by 180 degrees */
+volatile int32_t pos = 0;       /* [count] Position, 6 * P_PAIR counts per revolution */
+volatile uint32_t tick_e = 0;   /* [microsecond] Time of the last counted Hall edge */
+volatile unsigned sec_0 = 0;    /* Sector of the last Hall edge, 0 = unknown */
+int stp = STOP_COAST;   /* Stop mode */
+int prf = PRF_SCURVE;   /* Move profile */
+PiGain gain = {0.0f, 0.0f};     /* Speed PI gains, kept in NVS */
+Model mdl = {0, 0.0, 0.0, 0.0, 0.0};    /* Identified speed response, kept in NVS */
+Preferences prefs;      /* NVS storage of tuning results */
+int dirty = 0;          /* Flag of tuning results not stored yet, written to NVS at standstill */
+Proto proto;            /* Binary protocol engine on the serial console */
+RegDev regDev;          /* Variables behind the protocol registers */
+int slp = 0;            /* Flag to sleep lightly when idle at standstill, off as the waking byte is lost */
+uint32_t tIn = 0;       /* [microsecond] Time of the last input on the console */
+uint32_t tFrame = 0;    /* [microsecond] Time of the last byte of a binary frame */
+int64_t tIdle = 0;      /* [microsecond] Time the motor came to standstill */
+int64_t tSlept = 0;     /* [microsecond] Time in light sleep since tIdle */
+
+/* Sector from Hall sensor signals H1 H2 H3, 0 = invalid */
+/* 011: 1, 001: 2, 101: 3, 100: 4, 110: 5, 010: 6 */
+const unsigned hallSec[8] = {0, 2, 6, 1, 4, 3, 5, 0};
 
 /* Define function protorypes */
 void setGPIO();
 void processCommand();
 void forcedCommutate(unsigned num, unsigned polePair, uint32_t tick_f);
 void produceSignal(unsigned sector);
+void driveSector(unsigned sec);
+void commutate();
+unsigned readHall();
+void setPhase(int inCh, int enCh, int state, uint32_t duty);
+void setDuty(int ch, uint32_t duty, uint32_t hpoint);
 void cbDriveMotor(int gpio, int level, uint32_t tick);
+void isrH1();
+void isrH2();
+void isrH3();
+void attachHall();
+void detachHall();
 void gateBlock();
+void stopMotor();
+void setBrake(uint32_t duty);
+float readSpeed();
+void autoTune();
+void loadGain();
+void storeGain(const Model *m);
+void moveTo(int32_t target);
+int readReg(int type, uint16_t reg, uint16_t *val);
+int writeReg(uint16_t reg, uint16_t val);
+int checkReg(uint16_t reg, uint16_t val);
+void gatePwm(int on);
+int64_t idleSleep(uint32_t tw);
+void benchWake();
 
 /* The setup function */
 void setup() {
@@ -97,10 +205,27 @@ void setup() {
     ledcAttachPin(IN1,IN1PWM);
     ledcAttachPin(IN2,IN2PWM);
     ledcAttachPin(IN3,IN3PWM);
+    ledcSetup(EN1PWM,F_PWM,8);
+    ledcSetup(EN2PWM,F_PWM,8);
+    ledcSetup(EN3PWM,F_PWM,8);
+    ledcAttachPin(EN1,EN1PWM);
+    ledcAttachPin(EN2,EN2PWM);
+    ledcAttachPin(EN3,EN3PWM);
+    gateBlock();
+
+/*Count position from now on, commutation only while comm is raised*/
+    sec_0 = readHall();
+    attachHall();
 
   M5.begin();
-  Serial.begin(115200);
+  Serial.begin(BAUD);
+  regDev = {&st, &mod, &drv, &dead, &stp, &pos, &sec_0, readSpeed, STILL, RUNNING,
+            DRV_ASYNC, DT_MAX, STOP_REGEN, 0};
+  protoInit(&proto, MB_ADDR, MB_GAP, readReg, writeReg, checkReg);
 
+/*Restore tuning results*/
+    loadGain();
+    tIdle = esp_timer_get_time();
 }
 
 /* The main function */
@@ -116,7 +241,20 @@ void loop() {
     Serial.println("  r: Raise modulation index                          ");
     Serial.println("  l: Lower modulation index                          ");
     Serial.println("  t: Show rotational speed                           ");
+    Serial.println("  a: Auto-tune speed PI gains                        ");
+    Serial.println("  g: Show speed PI gains                             ");
+    Serial.println("  y: Toggle synchronous rectification                ");
+    Serial.println("  d: Step additional dead time                       ");
+    Serial.println("  b: Cycle stop mode (coast/brake/regen)             ");
+    Serial.println("  f: Move forward by one index                       ");
+    Serial.println("  v: Move reverse by one index                       ");
+    Serial.println("  k: Toggle move profile (S-curve/trapezoid)         ");
+    Serial.println("  p: Show position                                   ");
+    Serial.println("  z: Zero position                                   ");
+    Serial.println("  i: Toggle light sleep when idle                    ");
+    Serial.println("  w: Measure wake latency from light sleep           ");
     Serial.println("  e: End this program                                ");
+    Serial.println("Binary: Modbus RTU frames at address 1 (see README)  ");
 
     /* Infinate loop, outer */
     while(1) {
@@ -131,27 +269,58 @@ void loop() {
         mod = MOD_F;
         forcedCommutate(NUM_F, P_PAIR, TICK_F);
 
-        Serial.println("Succeeded in getting into the 6-pulse (120-degree) control mode by ISR callback functions.");
+        /* Lower the flag */
+        called = 0;
+
+        /* Let callback functions start 6-pulse control with Hall sensor signals */
+        Serial.println("Getting into the 6-pulse (120-degree) control mode by ISR callback functions...");
+        mod = MOD_I;
+        comm = 1;
+
+        /* Check whether successfully got into the 6-pulse mode */
+        delay(CHKDLY / 1000);
+        if(!called) {
+            Serial.println("Failed to get into the 6-pulse (120-degree) control  mode by ISR callback functions.");
+            comm = 0;
+            gateBlock();
+            st = STILL;
+            continue;
+        }
+        else {
+            Serial.println("Succeeded in getting into the 6-pulse (120-degree) control mode by ISR callback functions.");
+        }
 
         /* Infinate loop, inner */
         while(st == RUNNING) {
             processCommand();
         }
 
+        /* Decelerate with the selected stop mode */
+        stopMotor();
+
+        /* Stop commutation by callback functions, keep counting position */
+        comm = 0;
+
         /* Gate block */
         gateBlock();
+        tIdle = esp_timer_get_time();
+        tSlept = 0;
+
     }
 }
 
 /* Function to process command from user */
 void processCommand()
 {
-    int c;
+    int c, n;
     int j = 0;
+    int st0 = st;
     uint64_t tick_ave = 0;
+    uint8_t frame[PROTO_MAX];
 
     /* Show prompt */
     Serial.println("bldc6p>> ");
+    tIn = micros();
 
     /* Obtain input */
     while(1) {
@@ -159,6 +328,20 @@ void processCommand()
         if ( Serial.available() > 0) {
 
         c = Serial.read();
+        tIn = micros();
+
+        /* Bytes of a binary frame do not reach the text console */
+        n = protoFeed(&proto, c, micros(), frame);
+        if (n > 0) {
+            Serial.write(frame, n);
+        }
+        if (n >= 0) {
+            tFrame = tIn;
+            if (st != st0) {
+                return;
+            }
+            continue;
+        }
 
         /* Process obtained command */
         switch (c) {
@@ -207,9 +390,68 @@ void processCommand()
 //                Serial.println("Rotational speed: %.2f rpm", 60.0 / (tick_ave / 1e6) / (long)P_PAIR);
                 return;
 
+            case 'a':   /* Auto-tune speed PI gains */
+                autoTune();
+                return;
+
+            case 'g':   /* Show speed PI gains */
+                Serial.printf("Speed PI gains: Kp = %.4e, Ki = %.4e /s\n", gain.kp, gain.ki);
+                return;
+
+            case 'y':   /* Toggle synchronous rectification */
+                drv = drv == DRV_SYNC ? DRV_ASYNC : DRV_SYNC;
+                Serial.println(drv == DRV_SYNC ? "Synchronous rectification." : "Diode freewheeling.");
+                return;
+
+            case 'd':   /* Step additional dead time */
+                dead = dead < DT_MAX ? dead + 1 : 0;
+                Serial.printf("Additional dead time: %d ns\n", (int)(dead * 1e9 / F_PWM / PWM_TOP));
+                return;
+
+            case 'b':   /* Cycle stop mode */
+                stp = (stp + 1) % 3;
+                Serial.println(stp == STOP_COAST ? "Stop mode: coast." :
+                               stp == STOP_BRAKE ? "Stop mode: brake." : "Stop mode: regenerative decel.");
+                return;
+
+            case 'f':   /* Move forward by one index */
+                moveTo(pos + MV_IDX);
+                return;
+
+            case 'v':   /* Move reverse by one index */
+                moveTo(pos - MV_IDX);
+                return;
+
+            case 'k':   /* Toggle move profile */
+                prf = prf == PRF_SCURVE ? PRF_TRAP : PRF_SCURVE;
+                Serial.println(prf == PRF_SCURVE ? "Move profile: S-curve." : "Move profile: trapezoid.");
+                return;
+
+            case 'p':   /* Show position */
+                Serial.printf("Position: %ld counts (%.2f rev)\n", (long)pos, (float)pos / CPR);
+                return;
+
+            case 'z':   /* Zero position */
+                pos = 0;
+                Serial.println("Position zeroed.");
+                return;
+
+            case 'i':   /* Toggle light sleep when idle */
+                slp = !slp;
+                Serial.println(slp ? "Light sleep when idle: on." : "Light sleep when idle: off.");
+                return;
+
+            case 'w':   /* Measure wake latency from light sleep */
+                benchWake();
+                return;
+
             case 'e':   /* Exit from this program */
                 Serial.println("Exiting from the program...");
+                detachHall();
                 gateBlock();
+                if (dirty) {
+                    storeGain(&mdl);
+                }
                 exit(0);
 
             case '\n':
@@ -219,6 +461,28 @@ void processCommand()
                 Serial.println("Unknown command.");
         }
         }
+
+        /* Frame of an unsupported function code ended by the gap: exception response */
+        else if ((n = protoIdle(&proto, micros(), frame)) > 0) {
+            Serial.write(frame, n);
+        }
+
+        /* Store tuning results only once the rotor has stopped: */
+        /* Hall callbacks, still counting position, are held off while flash is written */
+        else if (st == STILL && dirty && readSpeed() == 0.0f) {
+            storeGain(&mdl);
+            dirty = 0;
+            Serial.println("Tuning results stored.");
+        }
+
+        /* Sleep lightly at standstill when nothing comes for a while, not within a binary frame: */
+        /* a partial frame is dropped by protoIdle() above after the silence of MB_GAP; */
+        /* not for MB_AWAKE after a binary frame either, as the waking byte would be a lost request */
+        else if (st == STILL && slp && !protoBusy(&proto) && micros() - tIn > IDLE_T &&
+                 micros() - tFrame > MB_AWAKE) {
+            idleSleep(0);
+            tIn = micros();
+        }
     }
 }
 
@@ -243,111 +507,579 @@ void forcedCommutate(unsigned num, unsigned polePair, uint32_t tick_f)
 /* Function to produce GPIO signals depending on selected sector */
 void produceSignal(unsigned sector)
 {
+    /* Duty of 8-bit PWM from modulation index */
+    uint32_t duty = (uint32_t)mod * PWM_MAX / 1000000;
+
     /* Produce necessary signals for Sector 1-6 */
     switch(sector) {
-        case 1:     /* Sector 1 */
-            /* Produce input (gate) signals */
-            ledcWrite(IN1PWM,128);
-            ledcWrite(IN2PWM,0);
-            ledcWrite(IN3PWM,0);
+        case 1:     /* Sector 1: U chopped, W low side */
+            setPhase(IN1PWM, EN1PWM, PH_PWM, duty);
+            setPhase(IN2PWM, EN2PWM, PH_OFF, 0);
+            setPhase(IN3PWM, EN3PWM, PH_LOW, 0);
+            break;
 
+        case 2:     /* Sector 2: V chopped, W low side */
+            setPhase(IN1PWM, EN1PWM, PH_OFF, 0);
+            setPhase(IN2PWM, EN2PWM, PH_PWM, duty);
+            setPhase(IN3PWM, EN3PWM, PH_LOW, 0);
+            break;
 
-            /* Produce enable (deblock) signals */
-            digitalWrite(EN1, DEB);
-            digitalWrite(EN2, GB);
-            digitalWrite(EN3, DEB);
+        case 3:     /* Sector 3: V chopped, U low side */
+            setPhase(IN1PWM, EN1PWM, PH_LOW, 0);
+            setPhase(IN2PWM, EN2PWM, PH_PWM, duty);
+            setPhase(IN3PWM, EN3PWM, PH_OFF, 0);
+            break;
 
-            /* Write 1 to Sector 1 signal */
-//            digitalWrite(SEC1, 1);
+        case 4:     /* Sector 4: W chopped, U low side */
+            setPhase(IN1PWM, EN1PWM, PH_LOW, 0);
+            setPhase(IN2PWM, EN2PWM, PH_OFF, 0);
+            setPhase(IN3PWM, EN3PWM, PH_PWM, duty);
+            break;
 
+        case 5:     /* Sector 5: W chopped, V low side */
+            setPhase(IN1PWM, EN1PWM, PH_OFF, 0);
+            setPhase(IN2PWM, EN2PWM, PH_LOW, 0);
+            setPhase(IN3PWM, EN3PWM, PH_PWM, duty);
             break;
 
-        case 2:     /* Sector 2 */
-            /* Produce input (gate) signals */
-            ledcWrite(IN1PWM,0);
-            ledcWrite(IN2PWM,128);
-            ledcWrite(IN3PWM,0);
+        case 6:     /* Sector 6: U chopped, V low side */
+            setPhase(IN1PWM, EN1PWM, PH_PWM, duty);
+            setPhase(IN2PWM, EN2PWM, PH_LOW, 0);
+            setPhase(IN3PWM, EN3PWM, PH_OFF, 0);
+            break;
+    }
+}
 
-            /* Produce enable (deblock) signals */
-            digitalWrite(EN1, GB);
-            digitalWrite(EN2, DEB);
-            digitalWrite(EN3, DEB);
+/* Function to produce GPIO signals for the sector of Hall sensor signals, in the direction of rev */
+/* The sector 180 degrees apart applies the opposite voltage and torque */
+void driveSector(unsigned sec)
+{
+    produceSignal(rev ? (sec + 2) % 6 + 1 : sec);
+}
 
-            /* Write 0 to Sector 1 signal */
-//            digitalWrite(SEC1, 0);
+/* Function to apply the present sector at once, e.g. at standstill where no Hall edge comes */
+void commutate()
+{
+    unsigned sec;
 
-            break;
+    noInterrupts();
+    sec = readHall();
+    if (sec != 0) {
+        driveSector(sec);
+    }
+    interrupts();
+}
 
-        case 3:     /* Sector 3 */
-            /* Produce input (gate) signals */
-            ledcWrite(IN1PWM,0);
-            ledcWrite(IN2PWM,128);
-            ledcWrite(IN3PWM,0);
+/* Function to obtain sector from Hall sensor signals, 0 if invalid */
+unsigned readHall()
+{
+    return hallSec[(digitalRead(H1) << 2) | (digitalRead(H2) << 1) | digitalRead(H3)];
+}
 
-            /* Produce enable (deblock) signals */
-            digitalWrite(EN1, DEB);
-            digitalWrite(EN2, DEB);
-            digitalWrite(EN3, GB);
+/* Function to produce IN and EN signals of one phase */
+/* The driver (L6230) turns the low side on when EN = 1 and IN = 0, with its own dead time */
+void setPhase(int inCh, int enCh, int state, uint32_t duty)
+{
+    switch(state) {
+        case PH_OFF:
+            setDuty(inCh, 0, 0);
+            setDuty(enCh, 0, 0);
+            break;
 
-            /* Write 0 to Sector 1 signal */
-//            digitalWrite(SEC1, 0);
+        case PH_LOW:
+            setDuty(inCh, 0, 0);
+            setDuty(enCh, PWM_TOP, 0);
+            break;
 
+        case PH_PWM:
+            if (drv == DRV_ASYNC) {
+                /* High side chopped by EN, current freewheels through the low-side body diode */
+                setDuty(inCh, PWM_TOP, 0);
+                setDuty(enCh, duty, 0);
+            }
+            else {
+                /* IN pulse ends where EN drops for the additional dead time, */
+                /* low side takes over when EN rises again at the start of the period */
+                if (duty > (uint32_t)(PWM_TOP - dead)) {
+                    duty = PWM_TOP - dead;
+                }
+                setDuty(inCh, duty, PWM_TOP - dead - duty);
+                setDuty(enCh, PWM_TOP - dead, 0);
+            }
             break;
+    }
+}
 
-        case 4:     /* Sector 4 */
-            /* Produce input (gate) signals */
-            ledcWrite(IN1PWM,0);
-            ledcWrite(IN2PWM,0);
-            ledcWrite(IN3PWM,128);
+/* Function to set duty and start point of a PWM channel in ticks */
+void setDuty(int ch, uint32_t duty, uint32_t hpoint)
+{
+    ledc_set_duty_with_hpoint(LEDC_HIGH_SPEED_MODE, (ledc_channel_t)ch, duty, hpoint);
+    ledc_update_duty(LEDC_HIGH_SPEED_MODE, (ledc_channel_t)ch);
+}
 
-            /* Produce enable (deblock) signals */
-            digitalWrite(EN1, DEB);
-            digitalWrite(EN2, GB);
-            digitalWrite(EN3, DEB);
+/* Callback function to choose sector depending on Hall sensor signals */
+void cbDriveMotor(int gpio, int level, uint32_t tick)
+{
+    unsigned sec = readHall();
 
-            /* Write 0 to Sector 1 signal */
-//            digitalWrite(SEC1, 0);
+    /* Raise the flag */
+    called = 1;
 
-            break;
+    /* Count position: +1 to the next sector, -1 to the previous one */
+    /* A missed edge (two sectors) is counted, three sectors apart the direction is unknown */
+    if (sec != 0 && sec_0 != 0 && sec != sec_0) {
+        switch ((sec + 6 - sec_0) % 6) {
+            case 1: pos += 1; break;
+            case 2: pos += 2; break;
+            case 4: pos -= 2; break;
+            case 5: pos -= 1; break;
+        }
+        tick_e = tick;
+    }
+    if (sec != 0) {
+        sec_0 = sec;
+    }
 
-        case 5:     /* Sector 5 */
-            /* Produce input (gate) signals */
-            ledcWrite(IN1PWM,0);
-            ledcWrite(IN2PWM,0);
-            ledcWrite(IN3PWM,128);
+    /* Storing tick difference of one electrical cycle into buffer, from 010 to 011 or 100 to 101 */
+    if (gpio == H3 && level == 1) {
+        tick_1 = tick_0;
+        tick_0 = tick;
+        tick_diff[k] = tick_0 - tick_1;
+        k = (k + 1) % MAF;
+    }
 
-            /* Produce enable (deblock) signals */
-            digitalWrite(EN1, GB);
-            digitalWrite(EN2, DEB);
-            digitalWrite(EN3, DEB);
+    /* Choose sector depending on Hall sensor signals */
+    if (comm && sec != 0) {
+        driveSector(sec);
+    }
+}
 
-            /* Write 0 to Sector 1 signal */
-//            digitalWrite(SEC1, 0);
+/* Interrupt handlers of Hall sensors */
+void isrH1()
+{
+    cbDriveMotor(H1, digitalRead(H1), micros());
+}
+
+void isrH2()
+{
+    cbDriveMotor(H2, digitalRead(H2), micros());
+}
+
+void isrH3()
+{
+    cbDriveMotor(H3, digitalRead(H3), micros());
+}
+
+/* Function to set callback functions on both edges of Hall sensors */
+void attachHall()
+{
+    attachInterrupt(digitalPinToInterrupt(H1), isrH1, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(H2), isrH2, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(H3), isrH3, CHANGE);
+}
 
+/* Function to cancel callback functions */
+void detachHall()
+{
+    detachInterrupt(digitalPinToInterrupt(H1));
+    detachInterrupt(digitalPinToInterrupt(H2));
+    detachInterrupt(digitalPinToInterrupt(H3));
+}
+
+/* Function to gate block */
+void gateBlock()
+{
+    setDuty(EN1PWM, 0, 0);
+    setDuty(EN2PWM, 0, 0);
+    setDuty(EN3PWM, 0, 0);
+}
+
+/* Function to decelerate with the selected stop mode, Hall callbacks still commutating */
+void stopMotor()
+{
+    int mod0 = mod;
+    int drv0 = drv;
+    float w, e;
+    uint32_t tick, t0, duty;
+
+    switch(stp) {
+        case STOP_REGEN:
+            /* Keep commutating with synchronous rectification and the applied voltage */
+            /* just below the back-EMF, so that the current flows back into the DC link */
+            /* The modulation index equivalent to the back-EMF is w / K of the identified model */
+            if (mdl.K <= 0.0) {
+                Serial.println("Not auto-tuned yet, no regenerative decel");
+            }
+            else {
+                Serial.println("Regenerative decel...");
+            }
+            drv = DRV_SYNC;
+            t0 = tick = micros();
+            while (mdl.K > 0.0 && (w = readSpeed()) > STOP_RPM && micros() - t0 < T_STOP) {
+                mod = (int)(w / mdl.K * (1.0f - RG_MAR / 1e6f));
+                if (mod > mod0) {
+                    mod = mod0;
+                }
+                tick += TS_ID;
+                while ((int32_t)(micros() - tick) < 0);
+            }
+            drv = drv0;
+            /* Fall through to brake the rest */
+
+        case STOP_BRAKE:
+            /* Short the windings through the low sides, keep measuring speed */
+            /* Shorted at full speed the current is the back-EMF over the winding and two switches, */
+            /* far above the rating of the L6230, so the low sides are chopped: in the off time the */
+            /* current returns to the DC link through the diodes, and the duty is chosen so that */
+            /* BK_MAR of the DC link voltage is left across the windings, which limits the current */
+            /* Not auto-tuned: the back-EMF is unknown, coast down to STOP_RPM before the short */
+            /* Speed reads 0 below one electrical cycle per TIMEOUT (86 rpm), where the duty is */
+            /* full: the short holds the rotor until no Hall edge has come for BK_SETL */
+            if (mdl.K <= 0.0) {
+                Serial.println("Not auto-tuned yet, coasting before braking");
+            }
+            Serial.println("Braking...");
+            comm = 0;
+            t0 = tick = micros();
+            while ((int32_t)(micros() - tick_e) < BK_SETL && micros() - t0 < T_STOP) {
+                w = readSpeed();
+                if (mdl.K <= 0.0) {
+                    duty = w > STOP_RPM ? 0 : PWM_TOP;
+                }
+                else {
+                    e = w / mdl.K - BK_MAR;
+                    duty = e <= 0.0f ? PWM_TOP : (e >= 1e6f ? 0 : PWM_TOP - (uint32_t)(e * PWM_TOP / 1e6f));
+                }
+                setBrake(duty);
+                tick += TS_ID;
+                while ((int32_t)(micros() - tick) < 0);
+            }
+
+            /* Release at standstill: all switches off */
+            gateBlock();
             break;
+    }
+    mod = mod0;
+}
+
+/* Function to short the windings through the low sides for duty [tick] of the PWM period, */
+/* all switches off for the rest */
+void setBrake(uint32_t duty)
+{
+    setDuty(IN1PWM, 0, 0);
+    setDuty(IN2PWM, 0, 0);
+    setDuty(IN3PWM, 0, 0);
+    setDuty(EN1PWM, duty, 0);
+    setDuty(EN2PWM, duty, 0);
+    setDuty(EN3PWM, duty, 0);
+}
+
+/* Function to obtain rotational speed [rpm] from the latest tick difference, 0 when stalled */
+float readSpeed()
+{
+    uint32_t tick = tick_0;
+    uint32_t diff = tick_diff[(k + MAF - 1) % MAF];
+
+    if (diff == 0 || micros() - tick > TIMEOUT) {
+        return 0.0f;
+    }
+    return 60.0e6f / diff / P_PAIR;
+}
+
+/* Function to identify the speed response to the modulation index and tune the speed PI gains */
+void autoTune()
+{
+    Ident id;
+    Model m;
+    int mod0 = mod;
+    int u;
+    float y, y0 = 0.0f;
+    unsigned i;
+    uint32_t tick;
+
+    if (st != RUNNING) {
+        Serial.println("Motor not running.");
+        return;
+    }
+
+    /* Measure the operating point */
+    Serial.println("Auto-tuning: measuring operating point...");
+    tick = micros();
+    for (i = 0; i < SET_ID; i++) {
+        tick += TS_ID;
+        while ((int32_t)(micros() - tick) < 0);
+        y0 += readSpeed();
+    }
+    y0 /= SET_ID;
+    if (y0 == 0.0f) {
+        Serial.println("Auto-tuning aborted: motor stalled.");
+        return;
+    }
+
+    /* Apply PRBS excitation and fit 1st- and 2nd-order models at the same time, */
+    /* next input clipped to the valid range of the modulation index */
+    Serial.println("Auto-tuning: applying PRBS excitation, 'h' to abort...");
+    identInit(&id, EXC_PRBS, A_ID, HOLD_ID, mod0, 1000000, y0);
+    for (i = 0; i < N_ID; i++) {
+        tick += TS_ID;
+        while ((int32_t)(micros() - tick) < 0);
+        y = readSpeed();
+        u = identStep(&id, y);
+        if (u < 0 || (Serial.available() > 0 && Serial.read() == 'h')) {
+            mod = mod0;
+            Serial.println("Auto-tuning aborted.");
+            return;
+        }
+        mod = u;
+    }
+    mod = mod0;
+
+    /* Choose model and compute gains */
+    if (identModel(&id, TS_ID * 1e-6, &m) < 0) {
+        Serial.println("Auto-tuning failed: no stable model fitted.");
+        return;
+    }
+    piTune(&m, TS_ID * 1e-6, LAM_ID, &gain);
+    mdl = m;
+    dirty = 1;
+
+    Serial.printf("Identified order %d model at %.1f rpm: K = %.4e rpm, tau1 = %.4f s, tau2 = %.4f s, delay = %.4f s\n",
+                  m.order, y0, m.K * 1000000, m.tau1, m.tau2, m.delay);
+    Serial.printf("Speed PI gains: Kp = %.4e, Ki = %.4e /s (stored at standstill)\n", gain.kp, gain.ki);
+}
+
+/* Function to restore speed PI gains and the identified model from NVS */
+void loadGain()
+{
+    prefs.begin("bldc6p", true);
+    gain.kp = prefs.getFloat("kp", 0.0f);
+    gain.ki = prefs.getFloat("ki", 0.0f);
+    mdl.K = prefs.getFloat("K", 0.0f);
+    mdl.tau1 = prefs.getFloat("tau1", 0.0f);
+    mdl.tau2 = prefs.getFloat("tau2", 0.0f);
+    mdl.delay = prefs.getFloat("delay", 0.0f);
+    mdl.order = mdl.tau2 > 0.0 ? 2 : 1;
+    prefs.end();
+}
+
+/* Function to store speed PI gains and the identified model into NVS */
+void storeGain(const Model *m)
+{
+    prefs.begin("bldc6p", false);
+    prefs.putFloat("kp", gain.kp);
+    prefs.putFloat("ki", gain.ki);
+    prefs.putFloat("K", m->K);
+    prefs.putFloat("tau1", m->tau1);
+    prefs.putFloat("tau2", m->tau2);
+    prefs.putFloat("delay", m->delay);
+    prefs.end();
+}
+/* Function to move to a target position [count] along the move profile */
+/* Position loop cascaded on the speed PI loop, with feed-forward through the identified model */
+void moveTo(int32_t target)
+{
+    Profile prof;
+    Servo srv;
+    VelEst ve;
+    int mod0 = mod;
+    int32_t p, from;
+    int u;
+    uint32_t te, tick, t0;
+    float t;
+    int done = 0;
 
-        case 6:     /* Sector 6 */
-            /* Produce input (gate) signals */
-            ledcWrite(IN1PWM,128);
-            ledcWrite(IN2PWM,0);
-            ledcWrite(IN3PWM,0);
+    if (st != STILL) {
+        Serial.println("Motor running, stop it first.");
+        return;
+    }
+    if (mdl.K <= 0.0 || mdl.tau1 <= 0.0) {
+        Serial.println("Not auto-tuned yet.");
+        return;
+    }
 
-            /* Produce enable (deblock) signals */
-            digitalWrite(EN1, DEB);
-            digitalWrite(EN2, DEB);
-            digitalWrite(EN3, GB);
+    /* Plan in counts, from the position at rest */
+    noInterrupts();
+    from = p = pos;
+    te = tick_e;
+    interrupts();
+    profileInit(&prof, from, target, MV_RPM * CPR / 60.0f, MV_ACC * CPR / 60.0f,
+                prf == PRF_SCURVE ? MV_JRK * CPR / 60.0f : 0.0f);
+    servoInit(&srv, &mdl, MV_LAM, MV_BW, CPR, TS_ID * 1e-6f, 1000000.0f, MV_TOL);
+    Serial.printf("Moving from %ld to %ld counts, %.3f s, 'h' to abort...\n", (long)from, (long)target, prof.T);
 
-            /* Write 0 to Sector 1 signal */
-//            digitalWrite(SEC1, 0);
+    /* Callback functions commutate, the sector is applied here as well while standing still */
+    mod = 0;
+    rev = 0;
+    comm = 1;
+    t0 = tick = micros();
+    velInit(&ve, p, te, tick, TIMEOUT);
+    while (1) {
+        tick += TS_ID;
+        while ((int32_t)(micros() - tick) < 0);
+        noInterrupts();
+        p = pos;
+        te = tick_e;
+        interrupts();
+        velUpdate(&ve, p, te, tick);
+        t = (tick - t0) * 1e-6f;
 
+        /* Finished when within the tolerance and no Hall edge for TIMEOUT */
+        if (t >= prof.T && abs(target - p) <= MV_TOL && ve.vel == 0.0f) {
+            done = 1;
             break;
+        }
+        if (t >= prof.T + T_SETL * 1e-6f || (Serial.available() > 0 && Serial.read() == 'h')) {
+            break;
+        }
+
+        u = servoUpdate(&srv, &prof, t, p, ve.vel);
+        rev = u < 0;
+        mod = u < 0 ? -u : u;
+        commutate();
     }
+    comm = 0;
+    gateBlock();
+    rev = 0;
+    mod = mod0;
+
+    Serial.printf("%s at %ld counts (target %ld) in %.3f s, profile %.3f s\n", done ? "Reached" : "Aborted",
+                  (long)p, (long)target, t, prof.T);
 }
 
-/* Function to gate block */
-void gateBlock()
+/* Function to read a register of the binary protocol, returns 0 or an exception code */
+int readReg(int type, uint16_t reg, uint16_t *val)
+{
+    return regRead(&regDev, type, reg, val);
+}
+
+/* Function to write a register of the binary protocol, returns 0 or an exception code */
+/* Start and stop act as the s and h commands, the modulation index takes effect at the next Hall edge */
+int writeReg(uint16_t reg, uint16_t val)
+{
+    return regWrite(&regDev, reg, val);
+}
+
+/* Function to check a register write of the binary protocol without writing, as writeReg() */
+int checkReg(uint16_t reg, uint16_t val)
+{
+    return regCheck(&regDev, reg, val);
+}
+
+/* Function to stop or restart the PWM timers, each shared by the IN and EN channels of a phase */
+void gatePwm(int on)
+{
+    int ch;
+
+    for (ch = IN1PWM; ch <= IN3PWM; ch += 2) {
+        if (on) {
+            ledc_timer_resume(LEDC_HIGH_SPEED_MODE, (ledc_timer_t)(ch / 2));
+        }
+        else {
+            ledc_timer_pause(LEDC_HIGH_SPEED_MODE, (ledc_timer_t)(ch / 2));
+        }
+    }
+}
+
+/* Function to sleep lightly at standstill until a byte on the console or a Hall edge, */
+/* or for tw [microsecond] if not 0; returns ready to start with PWM timers and Hall callbacks back */
+/* Returns the time of the wake event [microsecond], for the timed wake as scheduled */
+int64_t idleSleep(uint32_t tw)
 {
-    digitalWrite(EN1, GB);
-    digitalWrite(EN2, GB);
-    digitalWrite(EN3, GB);
-}
\ No newline at end of file
+    int64_t t0, t1;
+
+    /* Drain console output, then stop the EN channels at once at low level: gateBlock() only */
+    /* takes effect at the next PWM period, which a paused timer never reaches */
+    /* setDuty() starts them again, so the first commutation after waking drives as usual */
+    Serial.flush();
+    gateBlock();
+    ledc_stop(LEDC_HIGH_SPEED_MODE, (ledc_channel_t)EN1PWM, 0);
+    ledc_stop(LEDC_HIGH_SPEED_MODE, (ledc_channel_t)EN2PWM, 0);
+    ledc_stop(LEDC_HIGH_SPEED_MODE, (ledc_channel_t)EN3PWM, 0);
+    gatePwm(0);
+
+    /* Wake on the level other than the present one of each Hall sensor, edge callbacks do not run */
+    detachHall();
+    gpio_wakeup_enable((gpio_num_t)H1, digitalRead(H1) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    gpio_wakeup_enable((gpio_num_t)H2, digitalRead(H2) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    gpio_wakeup_enable((gpio_num_t)H3, digitalRead(H3) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    uart_set_wakeup_threshold(UART_NUM_0, WAKE_EDGE);
+    esp_sleep_enable_uart_wakeup(UART_NUM_0);
+    if (tw > 0) {
+        esp_sleep_enable_timer_wakeup(tw);
+    }
+
+    t0 = esp_timer_get_time();
+    esp_light_sleep_start();
+    t1 = esp_timer_get_time();
+    if (tw > 0) {
+        esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+    }
+    tSlept += t1 - t0;
+
+    /* Edge callbacks back, then count a sector change while asleep as a callback would */
+    gpio_wakeup_disable((gpio_num_t)H1);
+    gpio_wakeup_disable((gpio_num_t)H2);
+    gpio_wakeup_disable((gpio_num_t)H3);
+    attachHall();
+    noInterrupts();
+    cbDriveMotor(H1, digitalRead(H1), micros());
+    interrupts();
+    gatePwm(1);
+
+    return tw > 0 ? t0 + tw : t1;
+}
+
+/* Function to measure latency from a timed wake to ready and to the first commutation, */
+/* and to show the idle current estimate from the time in light sleep at standstill */
+void benchWake()
+{
+    int64_t tw, t1, t2, tAll = esp_timer_get_time() - tIdle, tS = tSlept;
+    int32_t dr, dc, rMin = INT32_MAX, rMax = INT32_MIN, cMin = INT32_MAX, cMax = INT32_MIN;
+    int64_t rSum = 0, cSum = 0;
+    int mod0 = mod;
+    unsigned i, n = 0;
+
+    if (st != STILL) {
+        Serial.println("Motor running, no wake latency measurement");
+        return;
+    }
+    Serial.printf("Light sleep %.1f %% of %.1f s at standstill: ESP32 %.2f mA estimated (%.1f mA awake, %.1f mA asleep)\n",
+                  tAll > 0 ? 100.0 * tSlept / tAll : 0.0, tAll * 1e-6, I_ACT - (I_ACT - I_SLEEP) * tSlept / (tAll > 0 ? tAll : 1),
+                  I_ACT, I_SLEEP);
+
+    /* First commutation at zero modulation index: windings shorted at most, no torque */
+    mod = 0;
+    for (i = 0; i < N_WAKE; i++) {
+        tw = idleSleep(T_WAKE);
+        t1 = esp_timer_get_time();
+        commutate();
+        t2 = esp_timer_get_time();
+        gateBlock();
+
+        /* Woken earlier by a Hall edge or the console */
+        if (t1 < tw) {
+            continue;
+        }
+        n++;
+        dr = (int32_t)(t1 - tw);
+        dc = (int32_t)(t2 - tw);
+        rSum += dr;
+        cSum += dc;
+        rMin = dr < rMin ? dr : rMin;
+        rMax = dr > rMax ? dr : rMax;
+        cMin = dc < cMin ? dc : cMin;
+        cMax = dc > cMax ? dc : cMax;
+    }
+    mod = mod0;
+    tSlept = tS;
+    if (n == 0) {
+        Serial.println("No timed wake, nothing measured");
+        return;
+    }
+
+    Serial.printf("Timed wakes: %u of %u\n", n, N_WAKE);
+    Serial.printf("Wake to ready: min %ld, avg %ld, max %ld us\n", (long)rMin, (long)(rSum / n), (long)rMax);
+    Serial.printf("Wake to first commutation: min %ld, avg %ld, max %ld us, %s %d us\n", (long)cMin, (long)(cSum / n),
+                  (long)cMax, cMax <= WAKE_MAX ? "within" : "BEYOND", WAKE_MAX);
+}
@@ -0,0 +1,227 @@
+/*
+ * test_main.cpp
+ * Unit tests of the move profile, velocity estimate and cascaded loops (lib/motion)
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ *
+ * Run: pio test -e native -f test_motion
+ */
+
+#include <math.h>
+#include <unity.h>
+
+#include "sysid.h"
+#include "motion.h"
+#include "bldc_plant.h"
+#include "autotune_sim.h"
+
+/* Define move parameters, same as src/main.cpp */
+#define CPR     42      /* [count] Hall edges per revolution */
+#define V_MAX   420.0f  /* [count/s] Speed limit, 600 rpm */
+#define A_MAX   4200.0f /* [count/s^2] Acceleration limit, 6000 rpm/s */
+#define J_MAX   42000.0f/* [count/s^3] Jerk limit, 60000 rpm/s^2 */
+#define MV_LAM  0.2     /* Speed loop time constant of moves relative to the identified plant */
+#define MV_BW   0.5     /* Position loop gain relative to the speed loop */
+#define MV_TOL  1       /* [count] Position tolerance to finish a move */
+
+/* Define test parameters */
+#define N_CHK   2000    /* Points to check along a profile */
+
+/* Function prototypes */
+void checkProfile(float from, float to, float jMax);
+long moveOn(const BldcPlant &plant, long dist, float jMax);
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/* Function to check a profile: limits kept, consistent derivatives, ends at rest on the target */
+void checkProfile(float from, float to, float jMax)
+{
+    Profile f;
+    float p, v, a, p0, v0, a0, dt;
+    int i;
+
+    profileInit(&f, from, to, V_MAX, A_MAX, jMax);
+    dt = f.T / N_CHK;
+    TEST_ASSERT_TRUE(f.T > 0.0f);
+    TEST_ASSERT_TRUE(f.vPeak <= V_MAX * 1.0001f);
+
+    profileAt(&f, 0.0f, &p0, &v0, &a0);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, from, p0);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.0f, v0);
+    for (i = 1; i <= N_CHK; i++) {
+        profileAt(&f, i * dt, &p, &v, &a);
+        TEST_ASSERT_TRUE(fabsf(v) <= V_MAX * 1.0001f);
+        TEST_ASSERT_TRUE(fabsf(a) <= A_MAX * 1.0001f);
+        if (jMax > 0.0f) {
+            TEST_ASSERT_TRUE(fabsf(a - a0) <= jMax * dt * 1.01f);
+        }
+        /* Never moves backward */
+        TEST_ASSERT_TRUE((p - p0) * f.dir >= -1e-3f);
+        /* Position is the integral of velocity, by the trapezoidal rule */
+        TEST_ASSERT_FLOAT_WITHIN(1e-3f * fabsf(to - from) + 1e-3f, p - p0, 0.5f * (v + v0) * dt);
+        p0 = p;
+        v0 = v;
+        a0 = a;
+    }
+    TEST_ASSERT_FLOAT_WITHIN(1e-3f, to, p);
+    profileAt(&f, f.T + 1.0f, &p, &v, &a);
+    TEST_ASSERT_EQUAL_FLOAT(to, p);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, v);
+}
+
+/* Trapezoid reaching the speed limit: accel, cruise and decel of 0.1 s each for 1 rev */
+void test_profile_trapezoid(void)
+{
+    Profile f;
+
+    profileInit(&f, 0.0f, CPR, V_MAX, A_MAX, 0.0f);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, V_MAX, f.vPeak);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.2f, f.T);
+    checkProfile(0.0f, CPR, 0.0f);
+    checkProfile(100.0f, 100.0f - 10 * CPR, 0.0f);
+}
+
+/* Trapezoid too short for the speed limit becomes a triangle */
+void test_profile_triangle(void)
+{
+    Profile f;
+
+    profileInit(&f, 0.0f, 3.0f, V_MAX, A_MAX, 0.0f);
+    TEST_ASSERT_FLOAT_WITHIN(1e-3f, sqrtf(3.0f * A_MAX), f.vPeak);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 0.0f, f.seg[3]);
+    checkProfile(0.0f, 3.0f, 0.0f);
+}
+
+/* S-curve moves: long, short of the speed limit, short of the acceleration limit, reverse */
+void test_profile_scurve(void)
+{
+    checkProfile(0.0f, 10 * CPR, J_MAX);
+    checkProfile(0.0f, CPR, J_MAX);
+    checkProfile(0.0f, 3.0f, J_MAX);
+    checkProfile(0.0f, -CPR, J_MAX);
+}
+
+/* Velocity from counts between edges, bounded while no edge comes, 0 after the timeout */
+void test_vel_estimate(void)
+{
+    VelEst v;
+
+    velInit(&v, 0, 0, 0, TIMEOUT);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, velUpdate(&v, 0, 0, TS_ID));
+
+    /* From rest: counts over the sampling period */
+    TEST_ASSERT_FLOAT_WITHIN(1e-3f, 2 * 1e6f / TS_ID, velUpdate(&v, 2, 35000, 2 * TS_ID));
+
+    /* Moving: counts between the last edges */
+    TEST_ASSERT_FLOAT_WITHIN(1e-3f, 4 * 1e6f / 20000, velUpdate(&v, 6, 55000, 3 * TS_ID));
+
+    /* No edge for 30 ms: not faster than one count over it */
+    TEST_ASSERT_FLOAT_WITHIN(1e-3f, 1e6f / 30000, velUpdate(&v, 6, 55000, 85000));
+
+    /* Reverse */
+    TEST_ASSERT_TRUE(velUpdate(&v, 5, 90000, 100000) < 0.0f);
+
+    /* Stall */
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, velUpdate(&v, 5, 90000, 90000 + TIMEOUT + 1));
+}
+
+/* Gains from the model, zero output at rest within the tolerance, output limited */
+void test_servo(void)
+{
+    Model m = {1, 5000.0 / 1e6, 0.05, 0.0, 0.0};
+    Profile f;
+    Servo s;
+
+    servoInit(&s, &m, MV_LAM, MV_BW, CPR, TS_ID * 1e-6f, 1000000.0f, MV_TOL);
+    TEST_ASSERT_FLOAT_WITHIN(1e-3f, 1e6f / 5000.0f, s.kff);
+    TEST_ASSERT_FLOAT_WITHIN(1e-3f, 0.05f * 1e6f / 5000.0f, s.kaf);
+    TEST_ASSERT_TRUE(s.kp > 0.0f && s.ki > 0.0f && s.kpp > 0.0f);
+
+    profileInit(&f, 0.0f, CPR, V_MAX, A_MAX, J_MAX);
+    TEST_ASSERT_EQUAL_INT(0, servoUpdate(&s, &f, f.T, CPR - MV_TOL, 0.0f));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, s.integ);
+    TEST_ASSERT_TRUE(servoUpdate(&s, &f, f.T, CPR - 2 * MV_TOL, 0.0f) > 0);
+    TEST_ASSERT_TRUE(servoUpdate(&s, &f, f.T, CPR + 2 * MV_TOL, 0.0f) < 0);
+
+    /* Far behind: saturated, the integral does not wind up */
+    s.integ = 0.0f;
+    TEST_ASSERT_EQUAL_INT(1000000, servoUpdate(&s, &f, 0.5f * f.T, -10 * CPR, 0.0f));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, s.integ);
+}
+
+/* Function to move dist [count] from standstill with the model identified by the auto-tuning */
+/* Returns the position error [count] at rest, or a large value if not finished in time */
+long moveOn(const BldcPlant &plant, long dist, float jMax)
+{
+    BldcPlant p = plant;
+    Model m;
+    Profile f;
+    VelEst ve;
+    Servo srv;
+    double t = 0.0, y0;
+    long cnt = 0, c;
+    uint32_t te = 0;
+    int u = 0;
+
+    if (autoTuneSim(&p, 1.0, EXC_PRBS, &m, &y0) < 0) {
+        return 1000;
+    }
+    p.i = p.w = p.theta = 0.0;
+
+    profileInit(&f, 0.0f, dist, V_MAX, A_MAX, jMax);
+    servoInit(&srv, &m, MV_LAM, MV_BW, CPR, TS_ID * 1e-6f, 1000000.0f, MV_TOL);
+    velInit(&ve, 0, 0, 0, TIMEOUT);
+    while (t < f.T + 1.0) {
+        /* Duty of 8-bit PWM, reverse torque as negative voltage */
+        double v = (double)((uint32_t)(u < 0 ? -u : u) * 255 / 1000000) / 255.0 * p.vbus;
+        double tNext = t + TS_ID * 1e-6;
+        while (t < tNext) {
+            p.step(u < 0 ? -v : v, DT_ID);
+            t += DT_ID;
+            c = (long)floor(p.elecAngle() / (M_PI / 3.0));
+            if (c != cnt) {
+                cnt = c;
+                te = (uint32_t)llround(t * 1e6);
+            }
+        }
+        velUpdate(&ve, cnt, te, (uint32_t)llround(t * 1e6));
+        if (t >= f.T && labs(dist - cnt) <= MV_TOL && ve.vel == 0.0f) {
+            return cnt - dist;
+        }
+        u = servoUpdate(&srv, &f, (float)t, cnt, ve.vel);
+    }
+    return 1000;
+}
+
+void test_move_small(void)
+{
+    TEST_ASSERT_INT_WITHIN(MV_TOL, 0, moveOn(PLANT_SMALL, CPR, J_MAX));
+    TEST_ASSERT_INT_WITHIN(MV_TOL, 0, moveOn(PLANT_SMALL, -10 * CPR, J_MAX));
+    TEST_ASSERT_INT_WITHIN(MV_TOL, 0, moveOn(PLANT_SMALL, CPR, 0.0f));
+}
+
+void test_move_heavy(void)
+{
+    TEST_ASSERT_INT_WITHIN(MV_TOL, 0, moveOn(PLANT_HEAVY, 10 * CPR, J_MAX));
+}
+
+void test_move_loaded(void)
+{
+    TEST_ASSERT_INT_WITHIN(MV_TOL, 0, moveOn(PLANT_LOADED, CPR, J_MAX));
+    TEST_ASSERT_INT_WITHIN(MV_TOL, 0, moveOn(PLANT_LOADED, -CPR, J_MAX));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_profile_trapezoid);
+    RUN_TEST(test_profile_triangle);
+    RUN_TEST(test_profile_scurve);
+    RUN_TEST(test_vel_estimate);
+    RUN_TEST(test_servo);
+    RUN_TEST(test_move_small);
+    RUN_TEST(test_move_heavy);
+    RUN_TEST(test_move_loaded);
+    return UNITY_END();
+}
@@ -0,0 +1,358 @@
+/*
+ * test_main.cpp
+ * Unit tests of the binary protocol engine and the register map (lib/proto)
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ *
+ * Run: pio test -e native -f test_proto
+ */
+
+#include <unity.h>
+
+#include "proto.h"
+#include "regmap.h"
+#include "device.h"
+
+/* Define test parameters */
+#define T_BYTE  11      /* [microsecond] Byte time at 921600 bit/s */
+
+/* Device state behind the registers */
+static volatile int st, mod, drv, dead, stp;
+static volatile int32_t pos;
+static volatile unsigned sec;
+static RegDev dev;
+static Proto proto;
+static uint32_t now;
+
+/* Function prototypes */
+float speed();
+int readReg(int type, uint16_t reg, uint16_t *val);
+int writeReg(uint16_t reg, uint16_t val);
+int checkReg(uint16_t reg, uint16_t val);
+int feed(const uint8_t *b, unsigned n, uint8_t *out);
+
+/* Function to obtain rotational speed [rpm] */
+float speed()
+{
+    return 1234.6f;
+}
+
+int readReg(int type, uint16_t reg, uint16_t *val)
+{
+    return regRead(&dev, type, reg, val);
+}
+
+int writeReg(uint16_t reg, uint16_t val)
+{
+    return regWrite(&dev, reg, val);
+}
+
+int checkReg(uint16_t reg, uint16_t val)
+{
+    return regCheck(&dev, reg, val);
+}
+
+void setUp(void)
+{
+    st = STILL;
+    mod = drv = dead = stp = 0;
+    pos = 0;
+    sec = 3;
+    dev = {&st, &mod, &drv, &dead, &stp, &pos, &sec, speed, STILL, RUNNING, DRV_ASYNC, DT_MAX, STOP_REGEN, 0};
+    protoInit(&proto, MB_ADDR, MB_GAP, readReg, writeReg, checkReg);
+    now = 1000;
+}
+
+void tearDown(void) {}
+
+/* Function to feed bytes back to back, returns the length of the last response, 0 if none */
+int feed(const uint8_t *b, unsigned n, uint8_t *out)
+{
+    int len = 0, r;
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        now += T_BYTE;
+        r = protoFeed(&proto, b[i], now, out);
+        if (r != 0) {
+            len = r;
+        }
+    }
+    return len;
+}
+
+/* CRC-16 of the Modbus specification example, and the frame builders */
+void test_crc(void)
+{
+    const uint8_t ref[8] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x0A, 0xC5, 0xCD};
+    uint8_t req[PROTO_MAX];
+
+    TEST_ASSERT_EQUAL_HEX16(0xCDC5, crc16(ref, 6));
+    TEST_ASSERT_EQUAL_UINT(8, protoReadReq(req, 1, FC_READ_HOLD, 0, 10));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(ref, req, 8);
+}
+
+/* Length of a response from its first bytes */
+void test_resp_len(void)
+{
+    const uint8_t rd[3] = {1, FC_READ_INPUT, 6}, ex[3] = {1, 0x86, EX_VALUE}, wr[3] = {1, FC_WRITE_ONE, 0};
+
+    TEST_ASSERT_EQUAL_UINT(0, protoRespLen(rd, 2));
+    TEST_ASSERT_EQUAL_UINT(11, protoRespLen(rd, 3));
+    TEST_ASSERT_EQUAL_UINT(5, protoRespLen(ex, 3));
+    TEST_ASSERT_EQUAL_UINT(8, protoRespLen(wr, 3));
+}
+
+/* Write single, echoed, read back, and the byte before a frame left to the console */
+void test_write_read(void)
+{
+    uint8_t req[PROTO_MAX], out[PROTO_MAX];
+    unsigned n;
+
+    TEST_ASSERT_EQUAL_INT(-1, protoFeed(&proto, 's', now, out));
+
+    n = protoWriteReq(req, MB_ADDR, HR_MOD, 4000);
+    TEST_ASSERT_EQUAL_INT(8, feed(req, n, out));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(req, out, 8);
+    TEST_ASSERT_EQUAL_INT(4000 * REG_MOD_DIV, mod);
+
+    n = protoReadReq(req, MB_ADDR, FC_READ_HOLD, HR_MOD, 1);
+    TEST_ASSERT_EQUAL_INT(7, feed(req, n, out));
+    TEST_ASSERT_EQUAL_UINT8(2, out[2]);
+    TEST_ASSERT_EQUAL_UINT16(4000, (out[3] << 8) | out[4]);
+    TEST_ASSERT_EQUAL_HEX16(crc16(out, 5), out[5] | (out[6] << 8));
+    TEST_ASSERT_EQUAL_UINT(2, proto.frames);
+}
+
+/* Write multiple: all registers written, or none with the exception of the first rejected one */
+void test_write_multi(void)
+{
+    const uint16_t ok[3] = {DRV_ASYNC, DT_MAX, STOP_REGEN}, bad[3] = {0, DT_MAX + 1, 0}, zero[3] = {0, 0, 0};
+    uint8_t req[PROTO_MAX], out[PROTO_MAX];
+    unsigned n;
+
+    n = protoWriteMultiReq(req, MB_ADDR, HR_DRV, 3, ok);
+    TEST_ASSERT_EQUAL_INT(8, feed(req, n, out));
+    TEST_ASSERT_EQUAL_UINT16(3, (out[4] << 8) | out[5]);
+    TEST_ASSERT_EQUAL_INT(DRV_ASYNC, drv);
+    TEST_ASSERT_EQUAL_INT(DT_MAX, dead);
+    TEST_ASSERT_EQUAL_INT(STOP_REGEN, stp);
+
+    n = protoWriteMultiReq(req, MB_ADDR, HR_DRV, 3, bad);
+    TEST_ASSERT_EQUAL_INT(5, feed(req, n, out));
+    TEST_ASSERT_EQUAL_HEX8(0x90, out[1]);
+    TEST_ASSERT_EQUAL_UINT8(EX_VALUE, out[2]);
+    TEST_ASSERT_EQUAL_INT(DRV_ASYNC, drv);
+    TEST_ASSERT_EQUAL_INT(DT_MAX, dead);
+    TEST_ASSERT_EQUAL_INT(STOP_REGEN, stp);
+
+    /* Beyond the last register */
+    n = protoWriteMultiReq(req, MB_ADDR, HR_DEAD, 3, zero);
+    TEST_ASSERT_EQUAL_INT(5, feed(req, n, out));
+    TEST_ASSERT_EQUAL_UINT8(EX_ADDRESS, out[2]);
+    TEST_ASSERT_EQUAL_INT(DT_MAX, dead);
+}
+
+/* Register map: commands, limits, status, speed, latched 32-bit position, sector */
+void test_regmap(void)
+{
+    uint16_t v;
+
+    TEST_ASSERT_EQUAL_INT(EX_VALUE, regWrite(&dev, HR_CMD, 0));
+    TEST_ASSERT_EQUAL_INT(EX_VALUE, regWrite(&dev, HR_CMD, CMD_ZERO + 1));
+    TEST_ASSERT_EQUAL_INT(0, regWrite(&dev, HR_CMD, CMD_START));
+    TEST_ASSERT_EQUAL_INT(RUNNING, st);
+    TEST_ASSERT_EQUAL_INT(0, regRead(&dev, REG_HOLD, HR_CMD, &v));
+    TEST_ASSERT_EQUAL_UINT16(0, v);
+    TEST_ASSERT_EQUAL_INT(0, regRead(&dev, REG_INPUT, IR_STAT, &v));
+    TEST_ASSERT_EQUAL_UINT16(RUNNING, v);
+    TEST_ASSERT_EQUAL_INT(0, regWrite(&dev, HR_CMD, CMD_STOP));
+    TEST_ASSERT_EQUAL_INT(STILL, st);
+
+    TEST_ASSERT_EQUAL_INT(0, regWrite(&dev, HR_MOD, REG_MOD_MAX));
+    TEST_ASSERT_EQUAL_INT(EX_VALUE, regWrite(&dev, HR_MOD, REG_MOD_MAX + 1));
+    TEST_ASSERT_EQUAL_INT(1000000, mod);
+    TEST_ASSERT_EQUAL_INT(EX_VALUE, regWrite(&dev, HR_DRV, DRV_ASYNC + 1));
+    TEST_ASSERT_EQUAL_INT(EX_VALUE, regWrite(&dev, HR_STOP, STOP_REGEN + 1));
+    TEST_ASSERT_EQUAL_INT(EX_ADDRESS, regWrite(&dev, HR_STOP + 1, 0));
+    TEST_ASSERT_EQUAL_INT(EX_VALUE, regCheck(&dev, HR_MOD, REG_MOD_MAX + 1));
+    TEST_ASSERT_EQUAL_INT(EX_ADDRESS, regCheck(&dev, HR_STOP + 1, 0));
+    TEST_ASSERT_EQUAL_INT(0, regCheck(&dev, HR_MOD, 0));
+    TEST_ASSERT_EQUAL_INT(1000000, mod);
+    TEST_ASSERT_EQUAL_INT(EX_ADDRESS, regRead(&dev, REG_HOLD, HR_STOP + 1, &v));
+    TEST_ASSERT_EQUAL_INT(EX_ADDRESS, regRead(&dev, REG_INPUT, IR_SEC + 1, &v));
+
+    TEST_ASSERT_EQUAL_INT(0, regRead(&dev, REG_INPUT, IR_RPM, &v));
+    TEST_ASSERT_EQUAL_UINT16(1234, v);
+    TEST_ASSERT_EQUAL_INT(0, regRead(&dev, REG_INPUT, IR_SEC, &v));
+    TEST_ASSERT_EQUAL_UINT16(3, v);
+
+    /* Low word as latched by the high word, even if the position moves in between */
+    pos = -2;
+    TEST_ASSERT_EQUAL_INT(0, regRead(&dev, REG_INPUT, IR_POSH, &v));
+    TEST_ASSERT_EQUAL_HEX16(0xFFFF, v);
+    pos = 0x10000;
+    TEST_ASSERT_EQUAL_INT(0, regRead(&dev, REG_INPUT, IR_POSL, &v));
+    TEST_ASSERT_EQUAL_HEX16(0xFFFE, v);
+    TEST_ASSERT_EQUAL_INT(0, regWrite(&dev, HR_CMD, CMD_ZERO));
+    TEST_ASSERT_EQUAL_INT(0, pos);
+}
+
+/* Exceptions: address, value, read count */
+void test_exception(void)
+{
+    uint8_t req[PROTO_MAX], out[PROTO_MAX];
+    unsigned n;
+
+    n = protoReadReq(req, MB_ADDR, FC_READ_HOLD, 100, 1);
+    TEST_ASSERT_EQUAL_INT(5, feed(req, n, out));
+    TEST_ASSERT_EQUAL_HEX8(0x83, out[1]);
+    TEST_ASSERT_EQUAL_UINT8(EX_ADDRESS, out[2]);
+    TEST_ASSERT_EQUAL_HEX16(crc16(out, 3), out[3] | (out[4] << 8));
+
+    n = protoWriteReq(req, MB_ADDR, HR_CMD, 0);
+    TEST_ASSERT_EQUAL_INT(5, feed(req, n, out));
+    TEST_ASSERT_EQUAL_UINT8(EX_VALUE, out[2]);
+
+    n = protoReadReq(req, MB_ADDR, FC_READ_INPUT, IR_STAT, 126);
+    TEST_ASSERT_EQUAL_INT(5, feed(req, n, out));
+    TEST_ASSERT_EQUAL_UINT8(EX_VALUE, out[2]);
+}
+
+/* Broadcast and other addresses: executed without response, or left to the console */
+void test_address(void)
+{
+    uint8_t req[PROTO_MAX], out[PROTO_MAX];
+    unsigned n;
+
+    n = protoWriteReq(req, PROTO_BCAST, HR_MOD, 300);
+    TEST_ASSERT_EQUAL_INT(0, feed(req, n, out));
+    TEST_ASSERT_EQUAL_INT(300 * REG_MOD_DIV, mod);
+
+    n = protoWriteReq(req, MB_ADDR + 1, HR_MOD, 400);
+    TEST_ASSERT_EQUAL_INT(-1, protoFeed(&proto, req[0], now, out));
+    TEST_ASSERT_EQUAL_INT(300 * REG_MOD_DIV, mod);
+}
+
+/* Dropped frames: CRC error, gap within a frame, unknown function, oversized byte count */
+void test_drop(void)
+{
+    uint8_t req[PROTO_MAX], out[PROTO_MAX];
+    unsigned n;
+
+    n = protoWriteReq(req, MB_ADDR, HR_MOD, 100);
+    req[4] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(0, feed(req, n, out));
+    TEST_ASSERT_EQUAL_UINT(1, proto.errors);
+    TEST_ASSERT_EQUAL_INT(0, mod);
+
+    /* Gap: the rest of a frame starts a new one and is not taken as the same request */
+    n = protoWriteReq(req, MB_ADDR, HR_MOD, 200);
+    feed(req, 4, out);
+    now += MB_GAP + 1;
+    TEST_ASSERT_EQUAL_INT(8, feed(req, n, out));
+    TEST_ASSERT_EQUAL_UINT(2, proto.errors);
+    TEST_ASSERT_EQUAL_INT(200 * REG_MOD_DIV, mod);
+
+    /* Unknown function: kept to the gap, the address byte in its body is not a frame start; */
+    /* dropped for its CRC at the next byte after the gap */
+    const uint8_t fc[6] = {MB_ADDR, 0x2B, MB_ADDR, FC_WRITE_ONE, 0, 0};
+    TEST_ASSERT_EQUAL_INT(0, feed(fc, 6, out));
+    now += MB_GAP + 1;
+    n = protoWriteReq(req, MB_ADDR, HR_MOD, 500);
+    TEST_ASSERT_EQUAL_INT(8, feed(req, n, out));
+    TEST_ASSERT_EQUAL_UINT(3, proto.errors);
+
+    /* Byte count beyond the frame buffer */
+    const uint8_t big[7] = {MB_ADDR, FC_WRITE_MULTI, 0, HR_MOD, 0, 125, 250};
+    TEST_ASSERT_EQUAL_INT(0, feed(big, 7, out));
+    TEST_ASSERT_EQUAL_UINT(4, proto.errors);
+    TEST_ASSERT_EQUAL_INT(500 * REG_MOD_DIV, mod);
+}
+
+/* Idle check: partial frame dropped after the gap without a further byte, */
+/* a frame of an unsupported function code answered with EX_FUNCTION */
+void test_idle(void)
+{
+    uint8_t req[PROTO_MAX], out[PROTO_MAX];
+    unsigned n;
+
+    TEST_ASSERT_EQUAL_INT(0, protoIdle(&proto, now, out));
+    TEST_ASSERT_EQUAL_INT(0, protoBusy(&proto));
+    n = protoWriteReq(req, MB_ADDR, HR_MOD, 300);
+    feed(req, 4, out);
+    TEST_ASSERT_EQUAL_INT(0, protoIdle(&proto, now + MB_GAP, out));
+    TEST_ASSERT_EQUAL_INT(1, protoBusy(&proto));
+    TEST_ASSERT_EQUAL_UINT(0, proto.errors);
+    TEST_ASSERT_EQUAL_INT(0, protoIdle(&proto, now + MB_GAP + 1, out));
+    TEST_ASSERT_EQUAL_INT(0, protoBusy(&proto));
+    TEST_ASSERT_EQUAL_UINT(1, proto.errors);
+
+    /* Unsupported function code with a valid CRC */
+    now += MB_GAP + 1;
+    n = protoReadReq(req, MB_ADDR, 0x2B, 0x0E01, 0);
+    TEST_ASSERT_EQUAL_INT(0, feed(req, n, out));
+    TEST_ASSERT_EQUAL_INT(1, protoBusy(&proto));
+    TEST_ASSERT_EQUAL_INT(5, protoIdle(&proto, now + MB_GAP + 1, out));
+    TEST_ASSERT_EQUAL_UINT8(MB_ADDR, out[0]);
+    TEST_ASSERT_EQUAL_HEX8(0xAB, out[1]);
+    TEST_ASSERT_EQUAL_UINT8(EX_FUNCTION, out[2]);
+    TEST_ASSERT_EQUAL_HEX16(crc16(out, 3), out[3] | (out[4] << 8));
+    TEST_ASSERT_EQUAL_UINT(1, proto.frames);
+    TEST_ASSERT_EQUAL_UINT(1, proto.errors);
+
+    /* Broadcast: no response; CRC error: dropped */
+    now += MB_GAP + 1;
+    n = protoReadReq(req, PROTO_BCAST, 0x2B, 0x0E01, 0);
+    feed(req, n, out);
+    TEST_ASSERT_EQUAL_INT(0, protoIdle(&proto, now + MB_GAP + 1, out));
+    TEST_ASSERT_EQUAL_UINT(2, proto.frames);
+    now += MB_GAP + 1;
+    n = protoReadReq(req, MB_ADDR, 0x2B, 0x0E01, 0);
+    req[3] ^= 0x01;
+    feed(req, n, out);
+    TEST_ASSERT_EQUAL_INT(0, protoIdle(&proto, now + MB_GAP + 1, out));
+    TEST_ASSERT_EQUAL_UINT(2, proto.errors);
+
+    /* Unknown length beyond the frame buffer: skipped to the gap */
+    now += MB_GAP + 1;
+    for (n = 0; n < PROTO_MAX + 10; n++) {
+        req[n % PROTO_MAX] = n < 2 ? (n == 0 ? MB_ADDR : 0x2B) : 0x55;
+        feed(&req[n % PROTO_MAX], 1, out);
+    }
+    TEST_ASSERT_EQUAL_UINT(3, proto.errors);
+    TEST_ASSERT_EQUAL_INT(1, protoBusy(&proto));
+    TEST_ASSERT_EQUAL_INT(0, protoIdle(&proto, now + MB_GAP + 1, out));
+    TEST_ASSERT_EQUAL_INT(0, protoBusy(&proto));
+}
+
+/* Requests back to back without gaps */
+void test_stream(void)
+{
+    uint8_t req[8 * 100], out[PROTO_MAX];
+    unsigned i, n = 0;
+
+    for (i = 0; i < 100; i++) {
+        n += protoWriteReq(req + n, MB_ADDR, HR_MOD, i);
+    }
+    TEST_ASSERT_EQUAL_INT(8, feed(req, n, out));
+    TEST_ASSERT_EQUAL_UINT(100, proto.frames);
+    TEST_ASSERT_EQUAL_UINT(0, proto.errors);
+    TEST_ASSERT_EQUAL_INT(99 * REG_MOD_DIV, mod);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_crc);
+    RUN_TEST(test_resp_len);
+    RUN_TEST(test_write_read);
+    RUN_TEST(test_write_multi);
+    RUN_TEST(test_regmap);
+    RUN_TEST(test_exception);
+    RUN_TEST(test_address);
+    RUN_TEST(test_drop);
+    RUN_TEST(test_idle);
+    RUN_TEST(test_stream);
+    return UNITY_END();
+}
@@ -0,0 +1,247 @@
+/*
+ * test_main.cpp
+ * Unit tests of the system identification and PI gain design (lib/sysid)
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ *
+ * Run: pio test -e native -f test_sysid
+ */
+
+#include <math.h>
+#include <unity.h>
+
+#include "sysid.h"
+#include "bldc_plant.h"
+#include "autotune_sim.h"
+
+/* Define test parameters */
+#define TS      0.02    /* [s] Sampling period */
+#define N_FIT   600     /* Samples fed to the estimator */
+
+/* Function prototypes */
+void feed(Rls *r, const double *a, const double *b, double c, unsigned n);
+void checkPlant(const BldcPlant &plant, int exc);
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/* Function to feed r with y[k] = a[0] y[k-1] + a[1] y[k-2] + b[0] u[k-1] + b[1] u[k-2] + c under PRBS */
+void feed(Rls *r, const double *a, const double *b, double c, unsigned n)
+{
+    Excite e;
+    double y = 0.0, y1 = 0.0, y2 = 0.0, u, u1 = 0.0, u2 = 0.0;
+    unsigned i;
+
+    exciteInit(&e, EXC_PRBS, 1, 2);
+    for (i = 0; i < n; i++) {
+        y = a[0] * y1 + a[1] * y2 + b[0] * u1 + b[1] * u2 + c;
+        u = exciteNext(&e);
+        rlsUpdate(r, u, y);
+        y2 = y1;
+        y1 = y;
+        u2 = u1;
+        u1 = u;
+    }
+}
+
+/* PRBS is a maximum length sequence of +/-amp, each bit held for hold samples */
+void test_prbs(void)
+{
+    Excite e;
+    int x[2 * 127 * 3];
+    int i, sum = 0;
+
+    exciteInit(&e, EXC_PRBS, 100, 3);
+    for (i = 0; i < 2 * 127 * 3; i++) {
+        x[i] = exciteNext(&e);
+        TEST_ASSERT_TRUE(x[i] == 100 || x[i] == -100);
+        if (i % 3) {
+            TEST_ASSERT_EQUAL_INT(x[i - 1], x[i]);
+        }
+    }
+    for (i = 0; i < 127 * 3; i++) {
+        TEST_ASSERT_EQUAL_INT(x[i], x[i + 127 * 3]);
+        sum += x[i];
+    }
+    /* 64 ones and 63 zeros */
+    TEST_ASSERT_EQUAL_INT(100 * 3, sum);
+}
+
+/* Step excitation stays at 0 for hold samples */
+void test_step(void)
+{
+    Excite e;
+    int i;
+
+    exciteInit(&e, EXC_STEP, 50, 10);
+    for (i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL_INT(0, exciteNext(&e));
+    }
+    TEST_ASSERT_EQUAL_INT(50, exciteNext(&e));
+}
+
+/* Exact 1st-order data: gain, time constant and fractional delay are recovered */
+void test_rls_first_order(void)
+{
+    const double a[2] = {0.8, 0.0}, b[2] = {0.3, 0.1};
+    Rls r;
+    Model m;
+
+    rlsInit(&r, 1, 1.0);
+    feed(&r, a, b, 5.0, N_FIT);
+    TEST_ASSERT_EQUAL_INT(0, rlsModel(&r, TS, &m));
+    TEST_ASSERT_EQUAL_INT(1, m.order);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-6, 2.0, m.K);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-6, -TS / log(0.8), m.tau1);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-6, 0.25 * TS, m.delay);
+}
+
+/* Exact 2nd-order data with poles 0.9 and 0.5 */
+void test_rls_second_order(void)
+{
+    const double a[2] = {1.4, -0.45}, b[2] = {0.05, 0.0};
+    Rls r;
+    Model m;
+
+    rlsInit(&r, 2, 1.0);
+    feed(&r, a, b, 0.0, N_FIT);
+    TEST_ASSERT_EQUAL_INT(0, rlsModel(&r, TS, &m));
+    TEST_ASSERT_EQUAL_INT(2, m.order);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-4, 1.0, m.K);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-5, -TS / log(0.9), m.tau1);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-5, -TS / log(0.5), m.tau2);
+}
+
+/* The 2nd-order estimate is chosen only if it fits clearly better */
+void test_rls_select(void)
+{
+    const double a1[2] = {0.8, 0.0}, a2[2] = {1.4, -0.45}, b[2] = {0.05, 0.0};
+    Rls r1, r2;
+
+    rlsInit(&r1, 1, 1.0);
+    rlsInit(&r2, 2, 1.0);
+    feed(&r1, a1, b, 0.0, N_FIT);
+    feed(&r2, a1, b, 0.0, N_FIT);
+    TEST_ASSERT_TRUE(rlsSelect(&r1, &r2) == &r1);
+
+    rlsInit(&r1, 1, 1.0);
+    rlsInit(&r2, 2, 1.0);
+    feed(&r1, a2, b, 0.0, N_FIT);
+    feed(&r2, a2, b, 0.0, N_FIT);
+    TEST_ASSERT_TRUE(rlsSelect(&r1, &r2) == &r2);
+}
+
+/* Unstable or sign-reversed estimates are rejected */
+void test_rls_reject(void)
+{
+    const double a[2] = {1.05, 0.0}, b[2] = {0.1, 0.0};
+    Rls r1, r2;
+    Model m;
+
+    rlsInit(&r1, 1, 1.0);
+    rlsInit(&r2, 2, 1.0);
+    TEST_ASSERT_EQUAL_INT(-1, rlsModel(&r1, TS, &m));
+    feed(&r1, a, b, 0.0, 100);
+    feed(&r2, a, b, 0.0, 100);
+    TEST_ASSERT_EQUAL_INT(-1, rlsModel(&r1, TS, &m));
+    TEST_ASSERT_NULL(rlsSelect(&r1, &r2));
+}
+
+/* Identification step: input clipped to 0 - uMax, fed normalized to the amplitude, -1 on a stall */
+void test_ident_step(void)
+{
+    Excite e;
+    Ident d;
+    int i, u, x;
+
+    exciteInit(&e, EXC_PRBS, 50, 1);
+    identInit(&d, EXC_PRBS, 50, 1, 20, 60, 100.0);
+    for (i = 0; i < 20; i++) {
+        x = exciteNext(&e);
+        u = identStep(&d, 100.0 + i);
+        TEST_ASSERT_EQUAL_INT(x > 0 ? 60 : 0, u);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-12, (u - 20) / 50.0, d.r1.u1);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-12, (u - 20) / 50.0, d.r2.u1);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-12, (double)i, d.r1.y1);
+    }
+    TEST_ASSERT_EQUAL_INT(-1, identStep(&d, 0.0));
+    TEST_ASSERT_EQUAL_UINT(20, d.r1.count);
+}
+
+/* SIMC rule: Kp = tau / (K (tc + theta)), Ti = min(tau, 4 (tc + theta)) */
+void test_pi_tune(void)
+{
+    Model m = {1, 2.0, 1.0, 0.0, 0.0};
+    PiGain g;
+    double theta = 0.5 * TS;
+
+    piTune(&m, TS, 1.0, &g);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, 1.0 / (2.0 * (1.0 + theta)), g.kp);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, g.kp / 1.0, g.ki);
+
+    /* Fast plant: closed loop not faster than the dead time, Ti clipped to the plant time constant */
+    m.tau1 = 0.001;
+    piTune(&m, TS, 1.0, &g);
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 0.001 / (2.0 * 2.0 * theta), g.kp);
+    TEST_ASSERT_FLOAT_WITHIN(1e-2, g.kp / 0.001, g.ki);
+
+    /* Half rule on 2nd order */
+    m.tau1 = 1.0;
+    m.tau2 = 0.1;
+    piTune(&m, TS, 0.5, &g);
+    theta = 0.05 + 0.5 * TS;
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, 1.05 / (2.0 * (0.525 + theta)), g.kp);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, g.kp / 1.05, g.ki);
+}
+
+/* Function to check the auto-tuning sequence on a simulated motor against its linearized model */
+void checkPlant(const BldcPlant &plant, int exc)
+{
+    BldcPlant p = plant;
+    Model m;
+    double tau1, tau2, y0;
+
+    p.timeConst(&tau1, &tau2);
+    TEST_ASSERT_EQUAL_INT(0, autoTuneSim(&p, 1.0, exc, &m, &y0));
+    TEST_ASSERT_DOUBLE_WITHIN(TOL_K, 1.0, m.K / (plant.gain() / 1e6));
+    TEST_ASSERT_DOUBLE_WITHIN(TOL_TAU, 1.0, m.tau1 / tau1);
+}
+
+void test_identify_small(void)
+{
+    checkPlant(PLANT_SMALL, EXC_PRBS);
+    checkPlant(PLANT_SMALL, EXC_STEP);
+}
+
+void test_identify_heavy(void)
+{
+    checkPlant(PLANT_HEAVY, EXC_PRBS);
+}
+
+void test_identify_inductive(void)
+{
+    checkPlant(PLANT_INDUCTIVE, EXC_PRBS);
+}
+
+void test_identify_loaded(void)
+{
+    checkPlant(PLANT_LOADED, EXC_PRBS);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_prbs);
+    RUN_TEST(test_step);
+    RUN_TEST(test_rls_first_order);
+    RUN_TEST(test_rls_second_order);
+    RUN_TEST(test_rls_select);
+    RUN_TEST(test_rls_reject);
+    RUN_TEST(test_ident_step);
+    RUN_TEST(test_pi_tune);
+    RUN_TEST(test_identify_small);
+    RUN_TEST(test_identify_heavy);
+    RUN_TEST(test_identify_inductive);
+    RUN_TEST(test_identify_loaded);
+    return UNITY_END();
+}
@@ -0,0 +1,92 @@
+/*
+ * autotune_sim.h
+ * The auto-tuning sequence of the firmware run on a simulated motor
+ * Sampling of autoTune() in src/main.cpp around the identification step of lib/sysid,
+ * the input applied at the next Hall edge as by the commutation of the firmware;
+ * shared by the host simulations and the native unit tests
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#ifndef AUTOTUNE_SIM_H
+#define AUTOTUNE_SIM_H
+
+#include <stdint.h>
+
+#include "sysid.h"
+#include "bldc_plant.h"
+
+/* Define auto-tuning parameters, same as src/main.cpp */
+#define TS_ID   20000   /* [microsecond] Sampling period of identification */
+#define HOLD_ID 5       /* Samples per PRBS bit */
+#define N_ID    1270    /* Number of identification samples: two PRBS periods */
+#define SET_ID  50      /* Samples to settle at the operating point before excitation */
+#define A_ID    60000   /* Excitation amplitude of modulation index: Note unity = 1,000,000 */
+#define TIMEOUT 100000  /* [microsecond] Stall timeout of speed reading */
+
+/* Define simulation parameters */
+#define DT_ID   5e-6    /* [s] Integration step */
+#define MOD_0   400000  /* Operating point of modulation index */
+#define TOL_K   0.10    /* Tolerance of static gain against the linearized plant, relative */
+#define TOL_TAU 0.15    /* Tolerance of dominant time constant against the linearized plant, relative */
+
+/* Function to run autoTune() at MOD_0 on plant p from standstill, with Hall edge noise jitter [microsecond] */
+/* and excitation type exc; the plant is left running at the end of the sequence */
+/* Returns 0 and the model [rpm per unit modulation index] in m, the operating speed [rpm] in y0, */
+/* -1 if stalled or no stable model */
+inline int autoTuneSim(BldcPlant *p, double jitter, int exc, Model *m, double *y0)
+{
+    HallTimer hall;
+    Ident id;
+    double t = 0.0, tNext, tau1, tau2;
+    int mod = MOD_0, drive = MOD_0;
+    long sector;
+    unsigned i;
+
+    /* Duty of 8-bit PWM from modulation index, as in produceSignal(), */
+    /* the modulation index taken at each Hall edge, as in cbDriveMotor() */
+    auto volt = [&](int md) { return (double)((uint32_t)md * 255 / 1000000) / 255.0 * p->vbus; };
+    auto advance = [&](double until) {
+        while (t < until) {
+            p->step(volt(drive), DT_ID);
+            t += DT_ID;
+            sector = hall.sector;
+            hall.update(p->elecAngle(), t);
+            if (hall.sector != sector) {
+                drive = mod;
+            }
+        }
+    };
+
+    /* Spin up to the operating point */
+    p->i = p->w = p->theta = 0.0;
+    hall.init(p->elecAngle(), jitter, TIMEOUT, p->polePair);
+    p->timeConst(&tau1, &tau2);
+    advance(10.0 * tau1 + 1.0);
+
+    /* Operating point and identification, sampled as in autoTune() */
+    tNext = t;
+    *y0 = 0.0;
+    for (i = 0; i < SET_ID; i++) {
+        tNext += TS_ID * 1e-6;
+        advance(tNext);
+        *y0 += hall.rpm(t);
+    }
+    *y0 /= SET_ID;
+    if (*y0 == 0.0) {
+        return -1;
+    }
+
+    identInit(&id, exc, A_ID, exc == EXC_STEP ? N_ID / 4 : HOLD_ID, MOD_0, 1000000, *y0);
+    for (i = 0; i < N_ID; i++) {
+        tNext += TS_ID * 1e-6;
+        advance(tNext);
+        mod = identStep(&id, hall.rpm(t));
+        if (mod < 0) {
+            return -1;
+        }
+    }
+    return identModel(&id, TS_ID * 1e-6, m);
+}
+
+#endif /* AUTOTUNE_SIM_H */
@@ -0,0 +1,171 @@
+/*
+ * bldc_plant.h
+ * Simple BLDC motor and Hall sensor models for host-side simulations
+ * DC-equivalent model of 6-pulse (120-degree) drive: the two conducting phases
+ * are lumped into line-to-line resistance, inductance and back-EMF constant
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#ifndef BLDC_PLANT_H
+#define BLDC_PLANT_H
+
+#include <math.h>
+#include <stdint.h>
+
+/* Motor and load */
+struct BldcPlant {
+    /* Parameters */
+    double vbus;        /* [V] DC link voltage */
+    double r;           /* [ohm] Line-to-line resistance */
+    double l;           /* [H] Line-to-line inductance */
+    double ke;          /* [V s/rad] Line-to-line back-EMF constant, equal to torque constant [N m/A] */
+    double j;           /* [kg m^2] Inertia of rotor and load */
+    double b;           /* [N m s/rad] Viscous friction */
+    double tLoad;       /* [N m] Constant load torque */
+    unsigned polePair;  /* Number of pole pairs */
+
+    /* State */
+    double i = 0.0;     /* [A] Line current */
+    double w = 0.0;     /* [rad/s] Mechanical speed */
+    double theta = 0.0; /* [rad] Mechanical angle, not wrapped */
+
+    /* Function to advance by dt [s] with average applied line voltage v [V] */
+    void step(double v, double dt)
+    {
+        i += (v - r * i - ke * w) / l * dt;
+        stepMech(dt);
+    }
+
+    /* Function to advance the mechanics only by dt [s] with the present current */
+    void stepMech(double dt)
+    {
+        double drive = ke * i - b * w;
+        double wNext;
+
+        if (w == 0.0) {
+            /* Load torque holds a stopped rotor until the motor torque exceeds it */
+            wNext = fabs(drive) <= tLoad ? 0.0 : (drive - copysign(tLoad, drive)) / j * dt;
+        }
+        else {
+            wNext = w + (drive - copysign(tLoad, w)) / j * dt;
+            if (wNext * w < 0.0 && fabs(ke * i) <= tLoad) {
+                wNext = 0.0;
+            }
+        }
+        w = wNext;
+        theta += w * dt;
+    }
+
+    /* Function to obtain mechanical speed [rpm] */
+    double rpm() const
+    {
+        return w * 60.0 / (2.0 * M_PI);
+    }
+
+    /* Function to obtain electrical angle [rad], not wrapped */
+    double elecAngle() const
+    {
+        return theta * polePair;
+    }
+
+    /* Function to obtain static gain [rpm per unit duty] of the linearized speed response */
+    double gain() const
+    {
+        return vbus * ke / (r * b + ke * ke) * 60.0 / (2.0 * M_PI);
+    }
+
+    /* Function to obtain time constants [s] of the linearized speed response, tau1 >= tau2 */
+    void timeConst(double *tau1, double *tau2) const
+    {
+        double tr = -(r / l + b / j);
+        double det = (r * b + ke * ke) / (l * j);
+        double disc = tr * tr / 4.0 - det;
+
+        if (disc < 0.0) {
+            /* Complex poles: report the envelope time constant twice */
+            *tau1 = *tau2 = -2.0 / tr;
+            return;
+        }
+        *tau1 = -1.0 / (tr / 2.0 + sqrt(disc));
+        *tau2 = -1.0 / (tr / 2.0 - sqrt(disc));
+    }
+};
+
+/* Reference plants of the host simulations and the native unit tests */
+/*                                  vbus  r    l       ke     j      b      tLoad  pp */
+const BldcPlant PLANT_SMALL =     {12.0, 1.0, 0.5e-3, 0.020, 2e-5,  1e-5,  0.002, 7};
+const BldcPlant PLANT_HEAVY =     {12.0, 1.0, 0.5e-3, 0.020, 2e-4,  1e-5,  0.002, 7};
+const BldcPlant PLANT_INDUCTIVE = {12.0, 1.0, 20e-3,  0.020, 4e-5,  1e-5,  0.002, 7};
+const BldcPlant PLANT_LOADED =    {24.0, 0.6, 0.4e-3, 0.035, 8e-5,  5e-5,  0.020, 7};
+
+/* Hall sensors and the tick difference buffer of the firmware */
+struct HallTimer {
+    double jitter;      /* [microsecond] Maximum edge latency, uniform (interrupt latency) */
+    uint32_t timeout;   /* [microsecond] Speed reads 0 if no sector-1 edge for this long */
+    unsigned polePair;  /* Number of pole pairs */
+
+    long sector;        /* Sector count (electrical angle / 60 deg), not wrapped */
+    uint32_t tick_0;    /* [microsecond] Last sector-1 edge */
+    uint32_t tick_e;    /* [microsecond] Last edge of any sector, as counted by the position */
+    uint32_t tick_diff; /* [microsecond] Last electrical period */
+    uint32_t pending;   /* [microsecond] Sector-1 edge whose interrupt has not run yet */
+    bool isPending;
+    uint32_t seed;      /* Noise generator state */
+
+    /* Function to initialize from the current electrical angle */
+    void init(double elecAngle, double jitterUs, uint32_t timeoutUs, unsigned pp)
+    {
+        jitter = jitterUs;
+        timeout = timeoutUs;
+        polePair = pp;
+        sector = (long)floor(elecAngle / (M_PI / 3.0));
+        tick_0 = 0;
+        tick_e = 0;
+        tick_diff = 0;
+        isPending = false;
+        seed = 12345;
+    }
+
+    /* Function to update with electrical angle at time t [s] */
+    void update(double elecAngle, double t)
+    {
+        long s = (long)floor(elecAngle / (M_PI / 3.0));
+        uint32_t now;
+
+        if (!isPending && s == sector) {
+            return;
+        }
+        now = (uint32_t)llround(t * 1e6);
+        /* Interrupt runs after its latency, timestamp taken by micros() in the handler */
+        if (isPending && (int32_t)(now - pending) >= 0) {
+            tick_diff = pending - tick_0;
+            tick_0 = pending;
+            isPending = false;
+        }
+        if (s != sector) {
+            tick_e = now;
+        }
+        while (s != sector) {
+            sector += s > sector ? 1 : -1;
+            if (((sector % 6) + 6) % 6 == 0) {
+                seed = seed * 1664525u + 1013904223u;
+                pending = (uint32_t)llround(t * 1e6 + jitter * ((seed >> 8) / 16777216.0));
+                isPending = true;
+            }
+        }
+    }
+
+    /* Function to obtain speed [rpm] the same way as readSpeed() of the firmware */
+    double rpm(double t) const
+    {
+        uint32_t now = (uint32_t)llround(t * 1e6);
+
+        if (tick_diff == 0 || now - tick_0 > timeout) {
+            return 0.0;
+        }
+        return 60.0e6 / tick_diff / polePair;
+    }
+};
+
+#endif /* BLDC_PLANT_H */
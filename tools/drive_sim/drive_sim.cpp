@@ -0,0 +1,350 @@
+/*
+ * drive_sim.cpp
+ * Host simulation of drive modes and stop modes of the firmware
+ * Switching-level model of the two conducting legs of the L6230 (IHM07M1) in one
+ * sector: conduction losses of synchronous rectification with additional dead time
+ * versus diode freewheeling at the same speed and load, and decel time and peak
+ * current of coast, current-limited brake and regenerative stop
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ *
+ * Build: g++ -O2 -std=c++17 -I../../lib/proto -I../common -o drive_sim drive_sim.cpp
+ * Usage: drive_sim
+ * Returns 1 if a stop mode exceeds the peak current rating of the driver
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "bldc_plant.h"
+#include "device.h"
+
+/* Define drive parameters, same as src/main.cpp */
+#define F_PWM   20000   /* [Hz], PWM carrier frequency */
+#define PWM_MAX 255     /* Full duty of 8-bit PWM */
+#define PWM_TOP 256     /* [tick] PWM period */
+#define TS_ID   20000   /* [microsecond] Update period of regenerative decel */
+#define RG_MAR  100000  /* Applied voltage below back-EMF in regenerative decel: Note unity = 1,000,000 */
+#define BK_MAR  100000  /* Voltage left across the windings in braking, of DC link voltage: Note unity = 1,000,000 */
+#define STOP_RPM 100    /* [rpm] Speed to finish active decel */
+#define T_STOP  5000000 /* [microsecond] Timeout of active decel */
+#define BK_SETL 200000  /* [microsecond] Time without a Hall edge to release the brake at standstill */
+#define TIMEOUT 100000  /* [microsecond] Speed reads 0 if no electrical cycle for this long */
+
+/* Define driver parameters (L6230) */
+#define RDS     0.73    /* [ohm] On-resistance of one switch */
+#define VF      0.9     /* [V] Body diode forward voltage */
+#define DT_INT  1e-6    /* [s] Dead time of the driver itself, assumed */
+#define I_MAX   2.8     /* [A] Peak output current rating */
+
+/* Define simulation parameters */
+#define DT      50e-9   /* [s] Integration step */
+#define T_SPIN  0.6     /* [s] Time to reach steady state */
+#define T_MEAS  0.1     /* [s] Time to average losses */
+#define T_SET   0.2     /* [s] Time to settle after a duty change */
+#define T_MAX   10.0    /* [s] Timeout of the rotor coming to rest */
+#define SPD_TOL 0.5     /* [rpm] Tolerance of matching the speed of drive modes */
+#define K_ERR   0.10    /* Error of the identified static gain, relative, as the auto-tuning tolerance */
+#define JITTER  1.0     /* [microsecond] Hall edge latency */
+
+/* Leg states */
+#define HS      0       /* High side on */
+#define LS      1       /* Low side on */
+#define OFF     2       /* Both switches off */
+
+/* Energy accounting */
+struct Meter {
+    double sw;          /* [J] Switch conduction */
+    double diode;       /* [J] Body diode conduction */
+    double copper;      /* [J] Winding */
+    double bus;         /* [J] Drawn from DC link, negative = returned */
+    double iPeak;       /* [A] Peak line current magnitude */
+};
+
+/* Simulation of two legs: A chopped, B return */
+struct Drive {
+    BldcPlant p;
+    Meter m;
+    double t;
+    HallTimer hall;     /* Speed reading and last Hall edge of the firmware */
+    double tMove;       /* [s] Time of the last step with the rotor turning */
+
+    /* Function to obtain voltage of a leg for current direction sgn (+1: into motor at A, out at B) */
+    double legVolt(int state, bool isA, int sgn)
+    {
+        double i = p.i;
+
+        if (isA) {
+            if (state == HS) return p.vbus - i * RDS;
+            if (state == LS) return -i * RDS;
+            return sgn > 0 ? -VF : p.vbus + VF;
+        }
+        if (state == HS) return p.vbus + i * RDS;
+        if (state == LS) return i * RDS;
+        return sgn > 0 ? p.vbus + VF : -VF;
+    }
+
+    /* Function to advance by DT with leg states a and b */
+    void step(int a, int b)
+    {
+        double e = p.ke * p.w;
+        double i0 = p.i;
+        bool open = a == OFF || b == OFF;
+        int sgn;
+
+        if (i0 != 0.0 || !open) {
+            sgn = i0 >= 0.0 ? 1 : -1;
+            p.i += (legVolt(a, true, sgn) - legVolt(b, false, sgn) - p.r * i0 - e) / p.l * DT;
+
+            /* Diodes block reverse current */
+            if (open && p.i * i0 < 0.0) {
+                p.i = 0.0;
+            }
+        }
+        else {
+            /* Discontinuous conduction: current starts only if a diode gets forward biased */
+            double up = legVolt(a, true, 1) - legVolt(b, false, 1) - e;
+            double dn = legVolt(a, true, -1) - legVolt(b, false, -1) - e;
+            if (up > 0.0) p.i = up / p.l * DT;
+            else if (dn < 0.0) p.i = dn / p.l * DT;
+        }
+        p.stepMech(DT);
+        t += DT;
+        hall.update(p.elecAngle(), t);
+        if (p.w != 0.0) {
+            tMove = t;
+        }
+
+        /* Losses with the current over this step */
+        double i = 0.5 * (i0 + p.i);
+        double ai = fabs(i);
+        m.copper += p.r * i * i * DT;
+        m.sw += ((a != OFF) + (b != OFF)) * RDS * i * i * DT;
+        m.diode += ((a == OFF) + (b == OFF)) * (ai > 0.0) * VF * ai * DT;
+        if (a == HS || (a == OFF && i < 0.0)) m.bus += p.vbus * i * DT;
+        if (b == HS || (b == OFF && i > 0.0)) m.bus -= p.vbus * i * DT;
+        if (ai > m.iPeak) m.iPeak = ai;
+    }
+
+    /* Function to obtain state of leg A at the present time, as produced by setPhase() */
+    /* Duty [tick] may be fractional here, to match operating points closer than 8-bit PWM */
+    int chopState(int drv, double duty, int dead)
+    {
+        double T = 1.0 / F_PWM;
+        double tick = T / PWM_TOP;
+        double x = fmod(t, T);
+
+        if (drv == DRV_ASYNC) {
+            return x < duty * tick ? HS : OFF;
+        }
+        if (duty > PWM_TOP - dead) {
+            duty = PWM_TOP - dead;
+        }
+        double tRise = (PWM_TOP - dead - duty) * tick;
+        double tFall = (PWM_TOP - dead) * tick;
+        if (duty == 0) return LS;
+        if (x >= tFall) return OFF;                     /* Additional dead time, EN low */
+        if (x >= tRise) return x < tRise + DT_INT ? OFF : HS;
+        if (dead == 0 && x < DT_INT) return OFF;        /* Driver dead time after IN falls */
+        return LS;
+    }
+
+    /* Function to run with PWM of duty [tick] until time until */
+    void run(int drv, double duty, int dead, double until)
+    {
+        while (t < until) {
+            step(chopState(drv, duty, dead), LS);
+        }
+    }
+
+    /* Function to brake until time until, low sides on for duty [tick] and all off for the rest, as setBrake() */
+    void brake(uint32_t duty, double until)
+    {
+        double T = 1.0 / F_PWM;
+        double tick = T / PWM_TOP;
+        while (t < until) {
+            int s = fmod(t, T) < duty * tick ? LS : OFF;
+            step(s, s);
+        }
+    }
+};
+
+/* Function prototypes */
+double pwmDuty(int mod);
+uint32_t brakeDuty(double rpm, double kSpd);
+Drive spinUp(const BldcPlant &plant, int drv, double duty, int dead);
+double measure(Drive &d, int drv, double duty, int dead);
+void steady(const BldcPlant &plant, int mod);
+bool decel(const BldcPlant &plant, int mod);
+
+/* Function to obtain duty [tick] of 8-bit PWM from modulation index, as in produceSignal() */
+double pwmDuty(int mod)
+{
+    return (double)((uint32_t)mod * PWM_MAX / 1000000);
+}
+
+/* Function to obtain low-side duty [tick] of the current-limited brake at speed rpm, as in stopMotor() */
+/* kSpd: static gain [rpm at full duty] of the identified model, 0 if not auto-tuned */
+uint32_t brakeDuty(double rpm, double kSpd)
+{
+    double e;
+
+    if (kSpd <= 0.0) {
+        return rpm > STOP_RPM ? 0 : PWM_TOP;
+    }
+    e = rpm / kSpd * 1e6 - BK_MAR;
+    if (e <= 0.0) {
+        return PWM_TOP;
+    }
+    if (e >= 1e6) {
+        return 0;
+    }
+    return PWM_TOP - (uint32_t)(e * PWM_TOP / 1e6);
+}
+
+/* Function to start from standstill and reach steady state */
+Drive spinUp(const BldcPlant &plant, int drv, double duty, int dead)
+{
+    Drive d = {plant, {0, 0, 0, 0, 0}, 0.0, {}, 0.0};
+
+    d.p.i = d.p.w = d.p.theta = 0.0;
+    d.hall.init(d.p.elecAngle(), JITTER, TIMEOUT, d.p.polePair);
+    d.run(drv, duty, dead, T_SPIN);
+    d.m = Meter{0, 0, 0, 0, 0};
+    return d;
+}
+
+/* Function to settle at duty and measure over T_MEAS, returns mean speed [rpm] with energies in d.m */
+double measure(Drive &d, int drv, double duty, int dead)
+{
+    d.run(drv, duty, dead, d.t + T_SET);
+    d.m = Meter{0, 0, 0, 0, 0};
+    double t0 = d.t, th0 = d.p.theta;
+    d.run(drv, duty, dead, t0 + T_MEAS);
+    return (d.p.theta - th0) / T_MEAS * 60.0 / (2.0 * M_PI);
+}
+
+/* Function to compare conduction losses of drive modes at the same speed and load */
+/* The speed of synchronous rectification without additional dead time at mod is the reference, */
+/* the other modes get the duty that reaches it, not quantized to 8 bits */
+void steady(const BldcPlant &plant, int mod)
+{
+    const struct { const char *name; int drv; int dead; } mode[] = {
+        {"sync, dead 0",            DRV_SYNC,  0},
+        {"sync, dead 5 (977 ns)",   DRV_SYNC,  5},
+        {"sync, dead 10 (1953 ns)", DRV_SYNC,  10},
+        {"async (diode)",           DRV_ASYNC, 0},
+    };
+    double kDuty = plant.gain() / PWM_TOP;   /* [rpm/tick] */
+    double rpmRef = 0.0;
+
+    printf("Steady state at the speed of mod %.2f, load %.3f N m\n", mod / 1e6, plant.tLoad);
+    printf("  %-24s %7s %8s %7s %8s %8s %8s %8s %8s %8s %7s\n", "Drive mode", "duty", "rpm", "I[A]",
+           "Pin[W]", "Pout[W]", "Psw[W]", "Pdio[W]", "Pcu[W]", "Ploss[W]", "eff[%]");
+    for (auto &md : mode) {
+        double duty = pwmDuty(mod);
+        Drive d = spinUp(plant, md.drv, duty, md.dead);
+        double rpm = measure(d, md.drv, duty, md.dead);
+        int n;
+
+        if (md.drv == DRV_SYNC && md.dead == 0) {
+            rpmRef = rpm;
+        }
+        for (n = 0; n < 8 && fabs(rpm - rpmRef) > SPD_TOL; n++) {
+            duty += (rpmRef - rpm) / kDuty;
+            rpm = measure(d, md.drv, duty, md.dead);
+        }
+        double pin = d.m.bus / T_MEAS;
+        double pout = plant.tLoad * rpm * 2.0 * M_PI / 60.0;
+        double cur = (plant.tLoad + plant.b * rpm * 2.0 * M_PI / 60.0) / plant.ke;
+        printf("  %-24s %7.2f %8.1f %7.3f %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %7.1f\n", md.name, duty, rpm, cur,
+               pin, pout, d.m.sw / T_MEAS, d.m.diode / T_MEAS, d.m.copper / T_MEAS,
+               (d.m.sw + d.m.diode) / T_MEAS, pin > 0.0 ? pout / pin * 100.0 : 0.0);
+    }
+    printf("\n");
+}
+
+/* Function to compare decel of stop modes from one operating point, returns false if over the current rating */
+/* Speed is read as readSpeed() does, 0 below one electrical cycle per TIMEOUT, and the brake is */
+/* released after BK_SETL without a Hall edge, as in stopMotor(); then the rotor coasts to rest */
+bool decel(const BldcPlant &plant, int mod)
+{
+    const struct { const char *name; int stp; double kErr; bool ref; } mode[] = {
+        {"coast",                 STOP_COAST, 0.0,    false},
+        {"brake",                 STOP_BRAKE, 0.0,    false},
+        {"brake, K +10%",         STOP_BRAKE, K_ERR,  false},
+        {"brake, K -10%",         STOP_BRAKE, -K_ERR, false},
+        {"brake, not tuned",      STOP_BRAKE, -1.0,   false},
+        {"regen + brake",         STOP_REGEN, 0.0,    false},
+        {"regen + brake, K +10%", STOP_REGEN, K_ERR,  false},
+        {"short (unlimited)",     STOP_BRAKE, 0.0,    true},
+    };
+    bool ok = true;
+
+    printf("Decel from mod %.2f, load %.3f N m, to rest, peak current rating %.1f A\n", mod / 1e6,
+           plant.tLoad, I_MAX);
+    printf("  %-22s %8s %9s %9s %9s %10s %9s %9s %9s\n", "Stop mode", "rpm0", "t_rg[ms]", "t_rel[ms]",
+           "rpm_rel", "t_rest[ms]", "Ebus[J]", "Eloss[J]", "Ipeak[A]");
+    for (auto &md : mode) {
+        Drive d = spinUp(plant, DRV_SYNC, pwmDuty(mod), 0);
+        double rpm0 = d.p.rpm(), t0 = d.t, t1, tRegen = 0.0, w;
+        auto us = [&]() { return (uint32_t)llround(d.t * 1e6); };
+        /* Static gain the auto-tuning would identify, with its error */
+        double kSpd = plant.gain() * (1.0 + md.kErr);
+
+        if (md.stp == STOP_REGEN) {
+            /* Applied voltage tracks the back-EMF from below, updated every TS_ID */
+            int mg;
+            while ((w = d.hall.rpm(d.t)) > STOP_RPM && d.t - t0 < T_STOP * 1e-6) {
+                mg = (int)(w / kSpd * 1e6 * (1.0 - RG_MAR / 1e6));
+                d.run(DRV_SYNC, pwmDuty(mg < mod ? mg : mod), 0, d.t + TS_ID * 1e-6);
+            }
+            tRegen = d.t - t0;
+        }
+        if (md.stp != STOP_COAST) {
+            /* Low-side duty updated every TS_ID, held until no Hall edge for BK_SETL */
+            t1 = d.t;
+            while ((int32_t)(us() - d.hall.tick_e) < BK_SETL && d.t - t1 < T_STOP * 1e-6) {
+                if (md.ref) {
+                    d.brake(PWM_TOP, d.t + TS_ID * 1e-6);
+                }
+                else {
+                    d.brake(brakeDuty(d.hall.rpm(d.t), kSpd), d.t + TS_ID * 1e-6);
+                }
+            }
+        }
+
+        /* Released: all switches off until the rotor rests */
+        double tRel = d.t - t0, rpmRel = d.p.rpm();
+        while (d.p.w != 0.0 && d.t - t0 < T_MAX) {
+            d.step(OFF, OFF);
+        }
+        bool over = !md.ref && d.m.iPeak > I_MAX;
+        printf("  %-22s %8.1f %9.1f %9.1f %9.1f %10.1f %9.4f %9.4f %9.3f  %s\n", md.name, rpm0, tRegen * 1e3,
+               tRel * 1e3, rpmRel, (d.tMove - t0) * 1e3, d.m.bus, d.m.sw + d.m.diode + d.m.copper, d.m.iPeak,
+               md.ref ? "reference" : (over ? "NG" : "OK"));
+        ok = ok && !over;
+    }
+    printf("\n");
+    return ok;
+}
+
+/* The main function */
+int main()
+{
+    /* The loaded 24V plant at a light and a heavy load torque */
+    BldcPlant light = PLANT_LOADED, loaded = PLANT_LOADED;
+    light.tLoad = 0.005;
+    loaded.tLoad = 0.040;
+
+    printf("Switch on-resistance %.2f ohm, diode %.2f V, driver dead time %.0f ns, PWM %d Hz\n",
+           RDS, VF, DT_INT * 1e9, F_PWM);
+    printf("Switching losses are not modeled\n\n");
+    steady(light, 300000);
+    steady(loaded, 600000);
+    steady(loaded, 900000);
+    bool ok = decel(light, 600000);
+    ok = decel(loaded, 900000) && ok;
+    printf("Stop modes %s the peak current rating\n", ok ? "within" : "exceed");
+    return ok ? 0 : 1;
+}
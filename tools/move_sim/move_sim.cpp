@@ -0,0 +1,169 @@
+/*
+ * move_sim.cpp
+ * Host simulation of point-to-point moves on the Hall-edge position counter
+ * Runs the same auto-tuning (lib/sysid), profile, velocity estimate and cascaded loops as
+ * the firmware (lib/motion) on simulated motors, and reports positioning accuracy and move time
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ *
+ * Build: g++ -O2 -std=c++17 -I../../lib/sysid -I../../lib/motion -I../common -o move_sim move_sim.cpp ../../lib/motion/motion.cpp ../../lib/sysid/sysid.cpp
+ * Usage: move_sim
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "sysid.h"
+#include "motion.h"
+#include "bldc_plant.h"
+#include "autotune_sim.h"
+
+/* Define move parameters, same as src/main.cpp */
+/* The speed loop runs at TS_ID, velocity reads 0 after TIMEOUT without a Hall edge (autotune_sim.h) */
+#define P_PAIR  7       /* Number of pole pairs */
+#define CPR     (6 * P_PAIR)    /* [count] Hall edges per revolution */
+#define MV_RPM  600     /* [rpm] Speed limit of moves */
+#define MV_ACC  6000    /* [rpm/s] Acceleration limit of moves */
+#define MV_JRK  60000   /* [rpm/s^2] Jerk limit of S-curve moves */
+#define MV_LAM  0.2     /* Speed loop time constant of moves relative to the identified plant */
+#define MV_BW   0.5     /* Position loop gain relative to the speed loop */
+#define MV_TOL  1       /* [count] Position tolerance to finish a move */
+#define T_SETL  1000000 /* [microsecond] Time allowed to settle after the profile ends */
+
+/* Define simulation parameters */
+#define DT      5e-6    /* [s] Integration step */
+#define T_REST  0.3     /* [s] Time to watch the rotor after the move ends */
+
+/* Profile types */
+#define PRF_TRAP    0
+#define PRF_SCURVE  1
+
+/* Simulation scenario */
+struct Scenario {
+    const char *name;
+    BldcPlant plant;
+    int prf;            /* PRF_TRAP or PRF_SCURVE */
+    long dist;          /* [count] Move distance */
+};
+
+/* Function prototypes */
+bool run(const Scenario &sc);
+
+/* Function to run one move from standstill, returns true if within tolerance and time */
+bool run(const Scenario &sc)
+{
+    BldcPlant p = sc.plant;
+    Model m;
+    Profile prof;
+    VelEst ve;
+    Servo srv;
+    double t = 0.0, tNext, tm, y0, eMax = 0.0, over = 0.0;
+    float pRef, vRef, aRef;
+    long cnt, target;
+    uint32_t te = 0;
+    int u = 0;
+    bool done = false, coast = false;
+
+    /* Model identified by the auto-tuning on the same plant, as the firmware would use it */
+    if (autoTuneSim(&p, 1.0, EXC_PRBS, &m, &y0) < 0) {
+        printf("%-30s %6ld  no stable model fitted                      NG\n", sc.name, sc.dist);
+        return false;
+    }
+
+    /* Duty of 8-bit PWM from modulation index, reverse torque as negative voltage */
+    auto volt = [&](int md) {
+        double v = (double)((uint32_t)(md < 0 ? -md : md) * 255 / 1000000) / 255.0 * p.vbus;
+        return md < 0 ? -v : v;
+    };
+    auto us = [](double tt) { return (uint32_t)llround(tt * 1e6); };
+    auto advance = [&](double until) {
+        while (t < until) {
+            if (coast) {
+                p.i = 0.0;
+                p.stepMech(DT);
+            }
+            else {
+                p.step(volt(u), DT);
+            }
+            t += DT;
+
+            /* Position counter and time of the last edge, as in cbDriveMotor() */
+            long c = (long)floor(p.elecAngle() / (M_PI / 3.0));
+            if (c != cnt) {
+                cnt = c;
+                te = us(t);
+            }
+        }
+    };
+
+    p.i = p.w = p.theta = 0.0;
+    cnt = 0;
+    target = cnt + sc.dist;
+
+    /* Same sequence as moveTo() */
+    profileInit(&prof, cnt, target, MV_RPM * CPR / 60.0f, MV_ACC * CPR / 60.0f,
+                sc.prf == PRF_SCURVE ? MV_JRK * CPR / 60.0f : 0.0f);
+    servoInit(&srv, &m, MV_LAM, MV_BW, CPR, TS_ID * 1e-6f, 1000000.0f, MV_TOL);
+    velInit(&ve, cnt, te, us(t), TIMEOUT);
+    tNext = t;
+    while (1) {
+        tNext += TS_ID * 1e-6;
+        advance(tNext);
+        tm = t;
+        velUpdate(&ve, cnt, te, us(t));
+        profileAt(&prof, (float)tm, &pRef, &vRef, &aRef);
+        if (fabs(pRef - cnt) > eMax) {
+            eMax = fabs(pRef - cnt);
+        }
+        if ((cnt - target) * (sc.dist > 0 ? 1 : -1) > over) {
+            over = (cnt - target) * (sc.dist > 0 ? 1 : -1);
+        }
+        if (tm >= prof.T && labs(target - cnt) <= MV_TOL && ve.vel == 0.0f) {
+            done = true;
+            break;
+        }
+        if (tm >= prof.T + T_SETL * 1e-6) {
+            break;
+        }
+        u = servoUpdate(&srv, &prof, (float)tm, cnt, ve.vel);
+    }
+
+    /* Gate block and watch the rotor come to rest */
+    coast = true;
+    advance(t + T_REST);
+    long err = cnt - target;
+
+    bool ok = done && labs(err) <= MV_TOL;
+    printf("%-30s %6ld  %6.3f %6.3f  %5.0f  %4.1f %4.1f  %+3ld  %s\n", sc.name, sc.dist, prof.T, tm,
+           prof.vPeak * 60.0f / CPR, eMax, over, err, ok ? "OK" : "NG");
+    return ok;
+}
+
+/* The main function */
+int main()
+{
+    const Scenario sc[] = {
+        {"small, trapezoid, 1 rev",         PLANT_SMALL,  PRF_TRAP,   CPR},
+        {"small, S-curve, 1 rev",           PLANT_SMALL,  PRF_SCURVE, CPR},
+        {"small, S-curve, 3 counts",        PLANT_SMALL,  PRF_SCURVE, 3},
+        {"small, S-curve, -10 rev",         PLANT_SMALL,  PRF_SCURVE, -10 * CPR},
+        {"heavy inertia, trapezoid, 1 rev", PLANT_HEAVY,  PRF_TRAP,   CPR},
+        {"heavy inertia, S-curve, 1 rev",   PLANT_HEAVY,  PRF_SCURVE, CPR},
+        {"heavy inertia, S-curve, 10 rev",  PLANT_HEAVY,  PRF_SCURVE, 10 * CPR},
+        {"loaded 24V, trapezoid, 1 rev",    PLANT_LOADED, PRF_TRAP,   CPR},
+        {"loaded 24V, S-curve, 1 rev",      PLANT_LOADED, PRF_SCURVE, CPR},
+        {"loaded 24V, S-curve, -1 rev",     PLANT_LOADED, PRF_SCURVE, -CPR},
+        {"loaded 24V, S-curve, 10 rev",     PLANT_LOADED, PRF_SCURVE, 10 * CPR},
+    };
+    int nOk = 0, n = sizeof(sc) / sizeof(sc[0]);
+
+    printf("Tolerance: %d count (%.1f deg), settle within %.1f s after the profile\n", MV_TOL,
+           360.0 * MV_TOL / CPR, T_SETL * 1e-6);
+    printf("%-30s %6s  %6s %6s  %5s  %4s %4s  %3s\n", "Scenario", "counts", "T[s]", "done",
+           "rpm", "eMax", "over", "err");
+    for (int i = 0; i < n; i++) {
+        nOk += run(sc[i]);
+    }
+    printf("%d/%d moves within tolerance\n", nOk, n);
+    return nOk == n ? 0 : 1;
+}
@@ -0,0 +1,404 @@
+/*
+ * proto_bench.cpp
+ * Host test harness of the binary protocol (lib/proto) over a pseudo-terminal pair
+ * A device thread runs the protocol engine on the slave side the way processCommand() does,
+ * with the register map of the firmware (lib/proto/regmap), and passes other bytes to a text console
+ * The host side checks requests, exceptions, dropped frames and coexistence with text,
+ * then measures round-trip latency and throughput, back to back and paced at 1 kHz
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ *
+ * Build: g++ -O2 -std=c++17 -pthread -I../../lib/proto -o proto_bench proto_bench.cpp ../../lib/proto/proto.cpp ../../lib/proto/regmap.cpp
+ * Usage: proto_bench [-n transactions] [-r rate_hz] [-t seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "proto.h"
+#include "regmap.h"
+#include "device.h"
+
+/* Define benchmark parameters */
+#define N_TX    20000   /* Transactions back to back */
+#define RATE    1000    /* [Hz] Paced setpoint streaming */
+#define T_RATE  5       /* [s] Duration of paced streaming */
+#define T_RESP  20000   /* [microsecond] Response timeout */
+
+/* Device state, as the firmware globals, guarded by lock against the host thread */
+static std::mutex lock;
+static volatile int st = STILL, mod, drv, dead, stp;
+static volatile int32_t pos;
+static volatile unsigned sec = 1;
+static RegDev regDev;
+static std::string console;
+static Proto proto;
+static std::atomic<bool> quit(false);
+
+/* Device state seen by the host thread */
+struct Snapshot {
+    int st, mod, drv, stp;
+    unsigned frames, errors;
+    std::string console;
+};
+
+/* Function to obtain monotonic time [microsecond] */
+static uint32_t micros()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+}
+
+/* Function to obtain monotonic time [nanosecond] */
+static uint64_t nanos()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Function to obtain rotational speed [rpm] of the device, always at rest */
+static float speed()
+{
+    return 0.0f;
+}
+
+/* Register read, write and check of the device, as readReg(), writeReg() and checkReg() of the firmware */
+/* Called by the engine with lock held */
+static int readReg(int type, uint16_t reg, uint16_t *val)
+{
+    return regRead(&regDev, type, reg, val);
+}
+
+static int writeReg(uint16_t reg, uint16_t val)
+{
+    return regWrite(&regDev, reg, val);
+}
+
+static int checkReg(uint16_t reg, uint16_t val)
+{
+    return regCheck(&regDev, reg, val);
+}
+
+/* Function to copy the device state for the host thread */
+static Snapshot snapshot()
+{
+    std::lock_guard<std::mutex> g(lock);
+    return Snapshot{st, mod, drv, stp, proto.frames, proto.errors, console};
+}
+
+/* Function to set the device position */
+static void setPos(int32_t p)
+{
+    std::lock_guard<std::mutex> g(lock);
+    pos = p;
+}
+
+/* Function to clear the device console */
+static void clearConsole()
+{
+    std::lock_guard<std::mutex> g(lock);
+    console.clear();
+}
+
+/* Device thread: bytes one by one into the engine, the rest to the console, */
+/* the idle check of the engine polled while no byte comes */
+static void device(int fd)
+{
+    uint8_t in[256], out[PROTO_MAX];
+    struct pollfd pfd = {fd, POLLIN, 0};
+    ssize_t n, i;
+    int len;
+
+    while (!quit) {
+        if (poll(&pfd, 1, 1) <= 0) {
+            std::lock_guard<std::mutex> g(lock);
+            len = protoIdle(&proto, micros(), out);
+            if (len > 0 && write(fd, out, len) != len) {
+                perror("write");
+            }
+            continue;
+        }
+        n = read(fd, in, sizeof(in));
+        std::lock_guard<std::mutex> g(lock);
+        for (i = 0; i < n; i++) {
+            len = protoFeed(&proto, in[i], micros(), out);
+            if (len > 0) {
+                if (write(fd, out, len) != len) {
+                    perror("write");
+                }
+            }
+            else if (len < 0) {
+                console += (char)in[i];
+            }
+        }
+        pos += 1;
+    }
+}
+
+/* Function to open a pseudo-terminal pair in raw mode */
+static int openPty(int *master, int *slave)
+{
+    struct termios tio;
+
+    *master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (*master < 0 || grantpt(*master) < 0 || unlockpt(*master) < 0) {
+        return -1;
+    }
+    *slave = open(ptsname(*master), O_RDWR | O_NOCTTY);
+    if (*slave < 0) {
+        return -1;
+    }
+    tcgetattr(*slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+    tcgetattr(*master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*master, TCSANOW, &tio);
+    return 0;
+}
+
+/* Function to send a request and wait for its response, returns response length, 0 on timeout */
+/* Bytes before the address are skipped as console text */
+static unsigned transact(int fd, const uint8_t *req, unsigned len, uint8_t *resp)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    unsigned got = 0, need = 0;
+    uint32_t t0 = micros();
+    ssize_t n;
+
+    if (write(fd, req, len) != (ssize_t)len) {
+        return 0;
+    }
+    while (need == 0 || got < need) {
+        int left = T_RESP - (int)(micros() - t0);
+        if (left <= 0 || poll(&pfd, 1, (left + 999) / 1000) <= 0) {
+            return 0;
+        }
+        n = read(fd, resp + got, need ? need - got : 1);
+        if (n <= 0) {
+            return 0;
+        }
+        if (got == 0 && resp[0] != req[0]) {
+            continue;
+        }
+        got += n;
+        if (need == 0) {
+            need = protoRespLen(resp, got);
+        }
+    }
+    if (crc16(resp, need - 2) != (resp[need - 2] | (resp[need - 1] << 8))) {
+        return 0;
+    }
+    return need;
+}
+
+/* Function to report one check */
+static bool check(const char *name, bool ok)
+{
+    printf("  %-52s %s\n", name, ok ? "OK" : "NG");
+    return ok;
+}
+
+/* Function to check requests, exceptions, dropped frames and text coexistence */
+static bool functional(int fd)
+{
+    uint8_t req[PROTO_MAX], resp[PROTO_MAX];
+    uint16_t val[3] = {DRV_ASYNC, 0, STOP_REGEN};
+    unsigned n;
+    bool ok = true;
+
+    printf("Functional checks\n");
+
+    n = protoWriteReq(req, MB_ADDR, HR_MOD, 4000);
+    ok &= check("write single register, echo", transact(fd, req, n, resp) == 8 && !memcmp(req, resp, 8));
+
+    n = protoReadReq(req, MB_ADDR, FC_READ_HOLD, HR_MOD, 1);
+    ok &= check("read holding register", transact(fd, req, n, resp) == 7 && resp[3] == 4000 >> 8 && resp[4] == (4000 & 0xFF));
+
+    n = protoWriteMultiReq(req, MB_ADDR, HR_DRV, 3, val);
+    n = transact(fd, req, n, resp);
+    ok &= check("write multiple registers", n == 8 && resp[5] == 3 && snapshot().drv == DRV_ASYNC &&
+                snapshot().stp == STOP_REGEN);
+
+    n = protoWriteReq(req, MB_ADDR, HR_CMD, CMD_START);
+    n = transact(fd, req, n, resp);
+    bool run = n == 8 && snapshot().st == RUNNING;
+    n = protoReadReq(req, MB_ADDR, FC_READ_INPUT, IR_STAT, 1);
+    n = transact(fd, req, n, resp);
+    ok &= check("start command, status reads running", run && n == 7 && resp[4] == RUNNING);
+
+    n = protoWriteReq(req, MB_ADDR, HR_CMD, CMD_STOP);
+    n = transact(fd, req, n, resp);
+    ok &= check("stop command, status still", n == 8 && snapshot().st == STILL);
+
+    setPos(0x12345);
+    n = protoReadReq(req, MB_ADDR, FC_READ_INPUT, IR_POSH, 2);
+    n = transact(fd, req, n, resp);
+    ok &= check("read input registers, 32-bit position latched", n == 9 && resp[2] == 4 &&
+                ((resp[3] << 24 | resp[4] << 16 | resp[5] << 8 | resp[6]) & ~0xFF) == 0x12300);
+
+    n = protoReadReq(req, MB_ADDR, FC_READ_HOLD, 100, 1);
+    ok &= check("exception, illegal data address", transact(fd, req, n, resp) == 5 && resp[1] == 0x83 && resp[2] == EX_ADDRESS);
+
+    n = protoWriteReq(req, MB_ADDR, HR_MOD, 20000);
+    ok &= check("exception, illegal data value", transact(fd, req, n, resp) == 5 && resp[1] == 0x86 && resp[2] == EX_VALUE);
+
+    n = protoWriteReq(req, MB_ADDR, HR_CMD, 0);
+    ok &= check("exception, command 0", transact(fd, req, n, resp) == 5 && resp[1] == 0x86 && resp[2] == EX_VALUE);
+
+    n = protoWriteReq(req, MB_ADDR, HR_STOP, STOP_REGEN + 1);
+    ok &= check("exception, stop mode out of range", transact(fd, req, n, resp) == 5 && resp[2] == EX_VALUE &&
+                snapshot().stp == STOP_REGEN);
+
+    uint16_t bad[3] = {0, DT_MAX + 1, 0};
+    n = protoWriteMultiReq(req, MB_ADDR, HR_DRV, 3, bad);
+    ok &= check("exception in a multiple write, nothing written", transact(fd, req, n, resp) == 5 &&
+                resp[1] == 0x90 && resp[2] == EX_VALUE && snapshot().drv == DRV_ASYNC);
+
+    n = protoReadReq(req, MB_ADDR, 0x2B, 0, 1);
+    ok &= check("exception, unsupported function after the gap", transact(fd, req, n, resp) == 5 &&
+                resp[1] == 0xAB && resp[2] == EX_FUNCTION);
+
+    unsigned e0 = snapshot().errors;
+    n = protoWriteReq(req, MB_ADDR, HR_MOD, 100);
+    req[4] ^= 0x01;
+    ok &= check("CRC error, no response", transact(fd, req, n, resp) == 0 && snapshot().errors == e0 + 1 &&
+                snapshot().mod == 4000 * REG_MOD_DIV);
+
+    n = protoWriteReq(req, MB_ADDR, HR_MOD, 200);
+    if (write(fd, req, 4) != 4) {
+        return false;
+    }
+    usleep(MB_GAP * 2);
+    ok &= check("partial frame dropped after the gap, next one served", transact(fd, req, n, resp) == 8 && snapshot().mod == 200 * REG_MOD_DIV);
+
+    n = protoWriteReq(req, PROTO_BCAST, HR_MOD, 300);
+    ok &= check("broadcast executed without response", transact(fd, req, n, resp) == 0 && snapshot().mod == 300 * REG_MOD_DIV);
+
+    clearConsole();
+    if (write(fd, "t\n", 2) != 2) {
+        return false;
+    }
+    n = protoWriteReq(req, MB_ADDR, HR_MOD, 400);
+    memcpy(req + n, "g\n", 2);
+    bool frame = transact(fd, req, n + 2, resp) == 8;
+    usleep(10000);
+    ok &= check("text commands around a frame reach the console", frame && snapshot().console == "t\ng\n");
+    printf("\n");
+    return ok;
+}
+
+/* Function to print latency statistics [microsecond] */
+static void stats(const char *name, std::vector<double> &rtt, double sec, unsigned lost)
+{
+    std::sort(rtt.begin(), rtt.end());
+    size_t n = rtt.size();
+    if (n == 0) {
+        printf("  %-22s no response\n", name);
+        return;
+    }
+    printf("  %-22s %7zu %9.0f  %7.1f %7.1f %7.1f %7.1f %7.1f  %5u\n", name, n, n / sec,
+           rtt[n / 2], rtt[n * 9 / 10], rtt[n * 99 / 100], rtt[n * 999 / 1000], rtt[n - 1], lost);
+}
+
+/* The main function */
+int main(int argc, char *argv[])
+{
+    int master, slave, opt;
+    unsigned nTx = N_TX, rate = RATE, tRate = T_RATE;
+    uint8_t req[PROTO_MAX], resp[PROTO_MAX];
+    unsigned i, n, lost;
+    uint64_t t0, next;
+    std::vector<double> rtt;
+
+    while ((opt = getopt(argc, argv, "n:r:t:")) != -1) {
+        switch (opt) {
+            case 'n': nTx = atoi(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            case 't': tRate = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n transactions] [-r rate_hz] [-t seconds]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (openPty(&master, &slave) < 0) {
+        perror("pty");
+        return 2;
+    }
+    regDev = {&st, &mod, &drv, &dead, &stp, &pos, &sec, speed, STILL, RUNNING, DRV_ASYNC, DT_MAX, STOP_REGEN, 0};
+    protoInit(&proto, MB_ADDR, MB_GAP, readReg, writeReg, checkReg);
+    std::thread dev(device, slave);
+
+    bool ok = functional(master);
+
+    /* Wire time of setpoint streaming: 10 bits per byte, request and echo of 8 bytes each */
+    printf("Wire time of a setpoint write (8 + 8 bytes): %.0f us at %d bit/s, %.0f us at 115200 bit/s\n",
+           16 * 10 * 1e6 / BAUD, BAUD, 16 * 10 * 1e6 / 115200);
+    printf("Round trip over the pseudo-terminal, without wire time [us]\n");
+    printf("  %-22s %7s %9s  %7s %7s %7s %7s %7s  %5s\n", "Mode", "n", "tx/s", "p50", "p90", "p99",
+           "p99.9", "max", "lost");
+
+    /* Back to back */
+    lost = 0;
+    t0 = nanos();
+    for (i = 0; i < nTx; i++) {
+        uint64_t t = nanos();
+        n = protoWriteReq(req, MB_ADDR, HR_MOD, i % 10001);
+        if (transact(master, req, n, resp) == 8) {
+            rtt.push_back((nanos() - t) / 1e3);
+        }
+        else {
+            lost++;
+        }
+    }
+    stats("back to back", rtt, (nanos() - t0) / 1e9, lost);
+
+    /* Paced setpoint streaming, a response is late if it misses the next period */
+    unsigned late = 0;
+    rtt.clear();
+    lost = 0;
+    t0 = next = nanos();
+    for (i = 0; i < rate * tRate; i++) {
+        next += 1000000000ull / rate;
+        n = protoWriteReq(req, MB_ADDR, HR_MOD, i % 10001);
+        uint64_t t = nanos();
+        if (transact(master, req, n, resp) == 8) {
+            rtt.push_back((nanos() - t) / 1e3);
+        }
+        else {
+            lost++;
+        }
+        if (nanos() > next) {
+            late++;
+        }
+        struct timespec ts = {(time_t)(next / 1000000000ull), (long)(next % 1000000000ull)};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "paced %u Hz", rate);
+    stats(name, rtt, (nanos() - t0) / 1e9, lost);
+    printf("  %u of %u responses later than one period\n", late, rate * tRate);
+    Snapshot sn = snapshot();
+    printf("Engine: %u frames, %u dropped\n", sn.frames, sn.errors);
+
+    quit = true;
+    dev.join();
+    ok &= lost == 0;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+/*
+ * sysid_sim.cpp
+ * Host simulation of the auto-tuning command against plants with known parameters
+ * Runs the same identification code as the firmware (lib/sysid) on simulated motors
+ * measured through Hall sensor timing, and compares fitted and true models
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ *
+ * Build: g++ -O2 -std=c++17 -I../../lib/sysid -I../common -o sysid_sim sysid_sim.cpp ../../lib/sysid/sysid.cpp
+ * Usage: sysid_sim
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "sysid.h"
+#include "bldc_plant.h"
+#include "autotune_sim.h"
+
+/* Define simulation parameters */
+#define LAM_ID  1.0     /* Closed-loop time constant relative to the identified plant, same as src/main.cpp */
+
+/* Simulation scenario */
+struct Scenario {
+    const char *name;
+    BldcPlant plant;
+    double jitter;      /* [microsecond] Hall edge noise */
+    int exc;            /* EXC_PRBS or EXC_STEP */
+};
+
+/* Function prototypes */
+bool run(const Scenario &sc);
+
+/* Function to run the auto-tuning procedure on one scenario, returns true if within tolerance */
+bool run(const Scenario &sc)
+{
+    BldcPlant p = sc.plant;
+    Model m;
+    PiGain g;
+    double tau1, tau2, y0;
+
+    /* Compare with the linearized plant */
+    p.timeConst(&tau1, &tau2);
+    double kTrue = p.gain() / 1e6;
+    if (autoTuneSim(&p, sc.jitter, sc.exc, &m, &y0) < 0) {
+        printf("%-28s  no stable model fitted                                    NG\n", sc.name);
+        return false;
+    }
+    piTune(&m, TS_ID * 1e-6, LAM_ID, &g);
+    double eK = m.K / kTrue - 1.0;
+    double eTau = m.tau1 / tau1 - 1.0;
+    bool ok = fabs(eK) < TOL_K && fabs(eTau) < TOL_TAU;
+    printf("%-28s  %4.0f  %d  %9.3e %+6.1f%%  %7.4f %7.4f %+6.1f%%  %7.4f %7.4f  %9.3e %9.3e  %s\n",
+           sc.name, y0, m.order, m.K * 1e6, eK * 100.0, tau1, m.tau1, eTau * 100.0,
+           tau2, m.tau2, g.kp, g.ki, ok ? "OK" : "NG");
+    return ok;
+}
+
+/* The main function */
+int main()
+{
+    const Scenario sc[] = {
+        {"small, PRBS",              PLANT_SMALL,     1.0,  EXC_PRBS},
+        {"small, step",              PLANT_SMALL,     1.0,  EXC_STEP},
+        {"small, PRBS, 20us jitter", PLANT_SMALL,     20.0, EXC_PRBS},
+        {"heavy inertia, PRBS",      PLANT_HEAVY,     1.0,  EXC_PRBS},
+        {"heavy inertia, step",      PLANT_HEAVY,     1.0,  EXC_STEP},
+        {"inductive, PRBS",          PLANT_INDUCTIVE, 1.0,  EXC_PRBS},
+        {"loaded 24V, PRBS",         PLANT_LOADED,    1.0,  EXC_PRBS},
+    };
+    int nOk = 0, n = sizeof(sc) / sizeof(sc[0]);
+
+    printf("Tolerance: K %.0f%%, tau1 %.0f%%\n", TOL_K * 100.0, TOL_TAU * 100.0);
+    printf("%-28s  %4s  %s  %9s %7s  %7s %7s %7s  %7s %7s  %9s %9s\n", "Scenario", "rpm", "n",
+           "K[rpm]", "err", "tau1", "fit", "err", "tau2", "fit", "Kp", "Ki");
+    for (int i = 0; i < n; i++) {
+        nOk += run(sc[i]);
+    }
+    printf("%d/%d scenarios within tolerance\n", nOk, n);
+    return nOk == n ? 0 : 1;
+}
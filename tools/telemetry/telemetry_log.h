@@ -0,0 +1,43 @@
+/*
+ * telemetry_log.h
+ * Binary log format of bench captures for the BLDC 6-pulse drive
+ * Shared by the log analyzer and the synthetic log generator
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#ifndef TELEMETRY_LOG_H
+#define TELEMETRY_LOG_H
+
+#include <stdint.h>
+
+/* File layout: one TelemetryHeader followed by TelemetryRecord entries in time order */
+#define TLOG_MAGIC      "BLDCLOG1"
+#define TLOG_VERSION    1
+
+/* Record kinds */
+#define REC_HALL        1   /* Hall edge, sector = sector entered by the edge (1-6) */
+#define REC_COMM        2   /* Commutation event, sector = sector driven (1-6) */
+#define REC_CURRENT     3   /* Phase current sample, ia/ib/ic in [mA], sector unused */
+
+/* File header */
+struct TelemetryHeader {
+    char     magic[8];      /* TLOG_MAGIC without terminating null */
+    uint32_t version;       /* TLOG_VERSION */
+    uint32_t polePair;      /* Number of pole pairs of the captured motor */
+};
+
+/* One captured event */
+struct TelemetryRecord {
+    uint32_t tick;          /* [microsecond] timestamp, wraps around like micros() */
+    uint8_t  kind;          /* REC_HALL, REC_COMM or REC_CURRENT */
+    uint8_t  sector;        /* Sector 1-6 */
+    int16_t  ia;            /* [mA] U-phase current */
+    int16_t  ib;            /* [mA] V-phase current */
+    int16_t  ic;            /* [mA] W-phase current */
+};
+
+static_assert(sizeof(TelemetryHeader) == 16, "TelemetryHeader must be 16 bytes");
+static_assert(sizeof(TelemetryRecord) == 12, "TelemetryRecord must be 12 bytes");
+
+#endif /* TELEMETRY_LOG_H */
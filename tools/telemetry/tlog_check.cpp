@@ -0,0 +1,167 @@
+/*
+ * tlog_check.cpp
+ * Self-check of the capture analyzer against synthetic captures
+ * Generates captures with known ripple, misalignment, jitter and delay (tlog_synth),
+ * analyzes them the same way as tlog_analyze (tlog_stats), and checks every statistic
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ *
+ * Build: g++ -O2 -std=c++17 -pthread -o tlog_check tlog_check.cpp tlog_stats.cpp tlog_synth.cpp
+ * Usage: tlog_check
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include <thread>
+#include <vector>
+
+#include "telemetry_log.h"
+#include "tlog_stats.h"
+#include "tlog_synth.h"
+
+/* Define tolerances */
+#define TOL_RPM     1e-3    /* Speed and electrical period, relative */
+#define TOL_WIDTH   0.05    /* [deg] Sector width error, electrical */
+#define TOL_SIGMA   0.05    /* Edge sigma, relative */
+#define TOL_PCTL    0.05    /* Edge deviation percentiles p50 to p99, relative */
+#define TOL_P999    0.10    /* Edge deviation percentile p99.9, relative */
+#define PCTL_JIT    0.5     /* [microsecond] Least jitter to check percentiles: below it the 1 us quantization */
+                            /* dominates and the edge deviation is not Gaussian */
+#define TOL_RIP     0.05    /* Ripple amplitude, relative */
+#define TOL_DELAY   0.01    /* [microsecond] Commutation delay */
+#define TOL_CUR     2e-3    /* Phase current rms, relative */
+#define TOL_SPUR    0.05    /* Second largest spectrum peak relative to the ripple */
+
+/* Percentiles of the magnitude of a standard normal variable */
+#define Z_P50       0.6745
+#define Z_P90       1.6449
+#define Z_P99       2.5758
+#define Z_P999      3.2905
+
+/* Check scenario */
+struct Scenario {
+    const char *name;
+    double seconds, rpm;
+    unsigned polePair;
+    double jitter, ripple, fRip;
+    double offset[7];
+    unsigned delay;
+};
+
+/* Function prototypes */
+bool check(const char *what, double expect, double got, double tol, bool rel);
+bool run(const Scenario &sc);
+
+/* Function to check one statistic, tolerance relative to expect if rel */
+bool check(const char *what, double expect, double got, double tol, bool rel)
+{
+    double err = rel ? fabs(got / expect - 1.0) : fabs(got - expect);
+    bool ok = err <= tol;
+
+    printf("  %-28s %12.4f %12.4f  %s\n", what, expect, got, ok ? "OK" : "NG");
+    return ok;
+}
+
+/* Function to generate, analyze and check one scenario, returns true if all statistics within tolerance */
+bool run(const Scenario &sc)
+{
+    SynthParam p;
+    SynthExpect x;
+    TlogStats s;
+    TlogOpt opt = {std::thread::hardware_concurrency(), FFT_N, true};
+    std::vector<TelemetryRecord> rec;
+    char what[32];
+    bool ok = true;
+    int i;
+
+    synthDefault(&p);
+    p.seconds = sc.seconds;
+    p.rpm = sc.rpm;
+    p.polePair = sc.polePair;
+    p.jitter = sc.jitter;
+    p.ripple = sc.ripple;
+    p.fRip = sc.fRip;
+    p.delay = sc.delay;
+    for (i = 0; i <= 6; i++) {
+        p.offset[i] = sc.offset[i];
+    }
+    tlogSynth(p, [&](const TelemetryRecord &r) { rec.push_back(r); }, &x);
+
+    printf("%s\n", sc.name);
+    printf("  %-28s %12s %12s\n", "Statistic", "expected", "analyzed");
+    if (tlogAnalyze(rec.data(), rec.size(), p.polePair, opt, &s) < 0) {
+        printf("  too few Hall edges  NG\n");
+        return false;
+    }
+    ok &= check("Hall edges", x.nEdge, s.nHall, 0.0, false);
+    ok &= check("sequence errors", 0.0, s.nBad, 0.0, false);
+    ok &= check("rotational speed [rpm]", x.rpm, s.rpmMean, TOL_RPM, true);
+    ok &= check("electrical period [us]", x.period, s.perMean, TOL_RPM, true);
+    for (i = 1; i <= 6; i++) {
+        snprintf(what, sizeof(what), "sector %d width error [deg]", i);
+        ok &= check(what, x.widthErr[i], s.width[i] - 60.0, TOL_WIDTH, false);
+    }
+    ok &= check("edge sigma [us]", x.edgeSigma, s.edgeSigma, TOL_SIGMA, true);
+
+    /* Edge deviation magnitude against the half-normal distribution of the generated edge sigma */
+    if (sc.jitter >= PCTL_JIT) {
+        ok &= check("edge deviation p50 [us]", Z_P50 * x.edgeSigma, s.jit.p50, TOL_PCTL, true);
+        ok &= check("edge deviation p90 [us]", Z_P90 * x.edgeSigma, s.jit.p90, TOL_PCTL, true);
+        ok &= check("edge deviation p99 [us]", Z_P99 * x.edgeSigma, s.jit.p99, TOL_PCTL, true);
+        ok &= check("edge deviation p99.9 [us]", Z_P999 * x.edgeSigma, s.jit.p999, TOL_P999, true);
+    }
+    else {
+        printf("  %-28s %12s %12s  quantization dominated, not checked\n", "edge deviation percentiles", "-", "-");
+    }
+    ok &= check("commutation delay [us]", x.delay, s.delayMean, TOL_DELAY, false);
+    ok &= check("sector mismatches", 0.0, s.commMismatch, 0.0, false);
+    for (i = 0; i < 3; i++) {
+        snprintf(what, sizeof(what), "phase %c current rms [mA]", "UVW"[i]);
+        ok &= check(what, x.curRms, s.curRms[i], TOL_CUR, true);
+    }
+
+    /* Largest peak is the ripple, other peaks are well below it and each is one line */
+    double res = s.fs / s.fftN;
+    size_t j, nNear = 0, nPk = s.peak.size();
+    for (i = 0; i < (int)nPk; i++) {
+        for (j = i + 1; j < nPk; j++) {
+            nNear += (s.peak[i].bin > s.peak[j].bin ? s.peak[i].bin - s.peak[j].bin
+                                                    : s.peak[j].bin - s.peak[i].bin) <= 2 * PK_BIN;
+        }
+    }
+    if (nPk == 0) {
+        printf("  no spectrum peak  NG\n");
+        return false;
+    }
+    ok &= check("ripple frequency [Hz]", x.rippleFreq, s.peak[0].freq, res, false);
+    ok &= check("ripple amplitude [rpm]", x.rippleAmp, s.peak[0].amp, TOL_RIP, true);
+    ok &= check("second peak / ripple", 0.0, nPk > 1 ? s.peak[1].amp / s.peak[0].amp : 0.0, TOL_SPUR, false);
+    ok &= check("peaks of one line", 0.0, nNear, 0.0, false);
+    return ok;
+}
+
+/* The main function */
+int main()
+{
+    const Scenario sc[] = {
+        {"README example: 1000 rpm, misaligned, 2 % at 5 Hz, 0.5 us jitter",
+         60.0, 1000.0, 7, 0.5, 2.0, 5.0, {0.0, 0.0, 2.0, -1.5, 0.0, 3.0, -2.0}, 3},
+        {"Aligned, defaults",
+         10.0, 1000.0, 7, 0.5, 2.0, 5.0, {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0}, 3},
+        {"3000 rpm, 4 pole pairs, 5 % at 12 Hz, 5 us jitter",
+         10.0, 3000.0, 4, 5.0, 5.0, 12.0, {0.0, -4.0, 1.0, 2.5, -1.0, 0.0, 6.0}, 3},
+        {"300 rpm, 1 % at 2 Hz, 0.1 us jitter, 10 us delay",
+         30.0, 300.0, 7, 0.1, 1.0, 2.0, {0.0, 1.0, -1.0, 0.5, -0.5, 2.0, -2.0}, 10},
+    };
+    int nOk = 0, n = sizeof(sc) / sizeof(sc[0]);
+
+    printf("Tolerance: speed %.1f%%, width %.2f deg, sigma %.0f%%, percentiles %.0f%% (p99.9 %.0f%%), ripple %.0f%%, "
+           "delay %.2f us, current %.1f%%\n\n", TOL_RPM * 100.0, TOL_WIDTH, TOL_SIGMA * 100.0, TOL_PCTL * 100.0,
+           TOL_P999 * 100.0, TOL_RIP * 100.0, TOL_DELAY, TOL_CUR * 100.0);
+    for (int i = 0; i < n; i++) {
+        nOk += run(sc[i]);
+    }
+    printf("\n%d/%d scenarios within tolerance\n", nOk, n);
+    return nOk == n ? 0 : 1;
+}
@@ -0,0 +1,490 @@
+/*
+ * tlog_stats.cpp
+ * Statistics of bench captures of the BLDC 6-pulse drive
+ * Per-sector period statistics, Hall sensor misalignment, edge jitter percentiles,
+ * commutation timing, phase currents and speed ripple spectrum
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <complex>
+#include <thread>
+#include <vector>
+
+#include "tlog_stats.h"
+
+/* Statistics of one sector */
+struct SectorStat {
+    uint64_t count = 0;
+    double sum = 0.0;
+    double sumSq = 0.0;
+    double min = INFINITY;
+    double max = 0.0;
+
+    void add(double x)
+    {
+        count++;
+        sum += x;
+        sumSq += x * x;
+        if (x < min) min = x;
+        if (x > max) max = x;
+    }
+
+    void merge(const SectorStat &o)
+    {
+        count += o.count;
+        sum += o.sum;
+        sumSq += o.sumSq;
+        if (o.min < min) min = o.min;
+        if (o.max > max) max = o.max;
+    }
+
+    double mean() const { return count ? sum / count : 0.0; }
+    double stdev() const
+    {
+        if (count < 2) return 0.0;
+        double m = mean();
+        double v = sumSq / count - m * m;
+        return v > 0.0 ? sqrt(v) : 0.0;
+    }
+};
+
+/* Per-chunk results of the record scan */
+struct ChunkScan {
+    size_t begin = 0, end = 0;      /* Record range */
+    size_t nHall = 0, nComm = 0;    /* Number of records of each kind */
+    size_t hallOff = 0, commOff = 0;/* Offsets into the extracted arrays */
+    uint64_t commMismatch = 0;      /* Commutations not matching the last Hall sector */
+    uint64_t nCur[7] = {};          /* Current samples per sector, 0 = before first edge */
+    double curSum[3] = {};          /* Sum of phase currents */
+    double curSumSq[3] = {};        /* Sum of squared phase currents */
+    double linkSum[7] = {};         /* Sum of DC link current estimates per sector */
+};
+
+/* Function prototypes */
+template <class F> void parallelFor(unsigned nThread, size_t n, F fn, size_t grain = 1024);
+template <class In, class Out> void parallelScan(unsigned nThread, size_t n, const In *in, Out *out);
+double percentile(std::vector<float> &v, double p);
+Pctl percentiles(std::vector<float> &v);
+void fft(std::vector<std::complex<double>> &x);
+
+/* Function to run fn(begin, end, thread) over n items split evenly among threads */
+template <class F> void parallelFor(unsigned nThread, size_t n, F fn, size_t grain)
+{
+    std::vector<std::thread> th;
+    unsigned t;
+
+    if (nThread <= 1 || n < nThread * grain) {
+        fn((size_t)0, n, 0u);
+        return;
+    }
+    for (t = 0; t < nThread; t++) {
+        size_t b = n * t / nThread;
+        size_t e = n * (t + 1) / nThread;
+        th.emplace_back(fn, b, e, t);
+    }
+    for (auto &x : th) {
+        x.join();
+    }
+}
+
+/* Function to compute out[0] = 0, out[i + 1] = out[i] + in[i] in two parallel passes */
+template <class In, class Out> void parallelScan(unsigned nThread, size_t n, const In *in, Out *out)
+{
+    std::vector<Out> part(nThread + 1, 0);
+    unsigned t;
+
+    /* Pass 1: chunk sums */
+    parallelFor(nThread, n, [&](size_t b, size_t e, unsigned th) {
+        Out s = 0;
+        for (size_t i = b; i < e; i++) s += in[i];
+        part[th + 1] = s;
+    });
+    for (t = 0; t < nThread; t++) {
+        part[t + 1] += part[t];
+    }
+
+    /* Pass 2: chunk-local prefix with offset */
+    out[0] = 0;
+    parallelFor(nThread, n, [&](size_t b, size_t e, unsigned th) {
+        Out s = part[th];
+        for (size_t i = b; i < e; i++) {
+            s += in[i];
+            out[i + 1] = s;
+        }
+    });
+}
+
+/* Function to obtain the p-th percentile (0-100) of v, reordering v */
+double percentile(std::vector<float> &v, double p)
+{
+    size_t idx;
+
+    if (v.empty()) return 0.0;
+    idx = (size_t)(p / 100.0 * (v.size() - 1) + 0.5);
+    std::nth_element(v.begin(), v.begin() + idx, v.end());
+    return v[idx];
+}
+
+/* Function to obtain the percentiles reported, reordering v */
+Pctl percentiles(std::vector<float> &v)
+{
+    Pctl p;
+
+    p.p50 = percentile(v, 50.0);
+    p.p90 = percentile(v, 90.0);
+    p.p99 = percentile(v, 99.0);
+    p.p999 = percentile(v, 99.9);
+    p.max = percentile(v, 100.0);
+    return p;
+}
+
+/* Function of in-place iterative radix-2 FFT, x.size() must be a power of two */
+void fft(std::vector<std::complex<double>> &x)
+{
+    size_t n = x.size();
+    size_t i, j, len;
+
+    /* Bit reversal permutation */
+    for (i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(x[i], x[j]);
+    }
+
+    /* Butterflies */
+    for (len = 2; len <= n; len <<= 1) {
+        std::complex<double> wl = std::polar(1.0, -2.0 * M_PI / len);
+        for (i = 0; i < n; i += len) {
+            std::complex<double> w(1.0, 0.0);
+            for (j = 0; j < len / 2; j++) {
+                std::complex<double> u = x[i + j];
+                std::complex<double> v = x[i + j + len / 2] * w;
+                x[i + j] = u + v;
+                x[i + j + len / 2] = u - v;
+                w *= wl;
+            }
+        }
+    }
+}
+
+/* Function to analyze nRec records of a capture, returns 0, or -1 if too few Hall edges */
+int tlogAnalyze(const TelemetryRecord *rec, size_t nRec, unsigned polePair, const TlogOpt &opt, TlogStats *res)
+{
+    const unsigned nThread = opt.nThread ? opt.nThread : 1;
+    const bool compensate = opt.compensate;
+    size_t fftN = opt.fftN;
+
+    /* Scan pass 1: count records of each kind per chunk */
+    std::vector<ChunkScan> chunk(nThread);
+    parallelFor(nThread, nRec, [&](size_t b, size_t e, unsigned th) {
+        ChunkScan &c = chunk[th];
+        c.begin = b;
+        c.end = e;
+        for (size_t r = b; r < e; r++) {
+            c.nHall += rec[r].kind == REC_HALL;
+            c.nComm += rec[r].kind == REC_COMM;
+        }
+    });
+
+    size_t nHall = 0, nComm = 0;
+    for (auto &c : chunk) {
+        c.hallOff = nHall;
+        c.commOff = nComm;
+        nHall += c.nHall;
+        nComm += c.nComm;
+    }
+    if (nHall < JIT_WIN + 1) {
+        return -1;
+    }
+
+    /* Scan pass 2: extract Hall edges, commutation delays and current sums */
+    std::vector<uint32_t> hallTick(nHall);
+    std::vector<uint8_t> hallSec(nHall);
+    std::vector<float> commDelay(nComm);
+    parallelFor(nThread, nRec, [&](size_t b, size_t e, unsigned th) {
+        ChunkScan &c = chunk[th];
+        size_t h = c.hallOff, m = c.commOff;
+        uint32_t lastTick = 0;
+        uint8_t lastSec = 0;
+        size_t r;
+
+        /* Find the Hall edge preceding this chunk */
+        for (r = b; r-- > 0;) {
+            if (rec[r].kind == REC_HALL) {
+                lastTick = rec[r].tick;
+                lastSec = rec[r].sector;
+                break;
+            }
+        }
+
+        for (r = b; r < e; r++) {
+            const TelemetryRecord &x = rec[r];
+            switch (x.kind) {
+                case REC_HALL:
+                    hallTick[h] = x.tick;
+                    hallSec[h] = x.sector;
+                    h++;
+                    lastTick = x.tick;
+                    lastSec = x.sector;
+                    break;
+
+                case REC_COMM:
+                    commDelay[m++] = lastSec ? (float)(uint32_t)(x.tick - lastTick) : NAN;
+                    c.commMismatch += lastSec && x.sector != lastSec;
+                    break;
+
+                case REC_CURRENT:
+                    c.nCur[lastSec <= 6 ? lastSec : 0]++;
+                    c.curSum[0] += x.ia;
+                    c.curSum[1] += x.ib;
+                    c.curSum[2] += x.ic;
+                    c.curSumSq[0] += (double)x.ia * x.ia;
+                    c.curSumSq[1] += (double)x.ib * x.ib;
+                    c.curSumSq[2] += (double)x.ic * x.ic;
+                    c.linkSum[lastSec <= 6 ? lastSec : 0] += 0.5 * (abs(x.ia) + abs(x.ib) + abs(x.ic));
+                    break;
+            }
+        }
+    });
+
+    /* Intervals between Hall edges: dt[i] is spent in sector hallSec[i] */
+    const size_t nInt = nHall - 1;
+    std::vector<float> dt(nInt);
+    std::vector<uint32_t> bad(nInt);
+    parallelFor(nThread, nInt, [&](size_t b, size_t e, unsigned) {
+        const uint32_t *__restrict tk = hallTick.data();
+        const uint8_t *__restrict sc = hallSec.data();
+        float *__restrict d = dt.data();
+        uint32_t *__restrict bd = bad.data();
+        for (size_t k = b; k < e; k++) {
+            d[k] = (float)(uint32_t)(tk[k + 1] - tk[k]);
+            bd[k] = sc[k + 1] != sc[k] % 6 + 1 || sc[k] < 1 || sc[k] > 6;
+        }
+    });
+    hallTick.clear();
+    hallTick.shrink_to_fit();
+
+    /* Cumulative time at each edge and cumulative count of sequence errors */
+    std::vector<double> T(nInt + 1);
+    std::vector<uint32_t> badCum(nInt + 1);
+    parallelScan(nThread, nInt, dt.data(), T.data());
+    parallelScan(nThread, nInt, bad.data(), badCum.data());
+    const uint64_t nBad = badCum[nInt];
+    auto windowOk = [&](size_t k, size_t len) { return badCum[k + len] == badCum[k]; };
+
+    /* Per-sector interval statistics and misalignment over complete electrical cycles */
+    std::vector<SectorStat> secPart(nThread * 7), misPart(nThread * 7);
+    std::vector<SectorStat> perPart(nThread);
+    parallelFor(nThread, nInt, [&](size_t b, size_t e, unsigned th) {
+        SectorStat *sec = &secPart[th * 7];
+        SectorStat *mis = &misPart[th * 7];
+        for (size_t k = b; k < e; k++) {
+            if (bad[k]) continue;
+            sec[hallSec[k]].add(dt[k]);
+            if (k + 6 <= nInt && windowOk(k, 6)) {
+                double per = T[k + 6] - T[k];
+                mis[hallSec[k]].add(dt[k] / per * 360.0);
+                if (hallSec[k] == 1) perPart[th].add(per);
+            }
+        }
+    });
+    SectorStat sec[7], mis[7], period;
+    for (unsigned t = 0; t < nThread; t++) {
+        for (int s = 1; s <= 6; s++) {
+            sec[s].merge(secPart[t * 7 + s]);
+            mis[s].merge(misPart[t * 7 + s]);
+        }
+        period.merge(perPart[t]);
+    }
+
+    /* Edge jitter: deviation of an edge from the quintic through its six same-sector neighbours, */
+    /* which cancels misalignment and speed changes up to the fifth order; a cubic leaves */
+    /* the fourth-order term of a slow speed ripple, e.g. 0.4 us rms of 2 % at 5 Hz and 1000 rpm */
+    std::vector<std::vector<float>> jitPart(nThread);
+    parallelFor(nThread, nInt, [&](size_t b, size_t e, unsigned th) {
+        std::vector<float> &out = jitPart[th];
+        for (size_t k = b; k < e && k + JIT_WIN <= nInt; k++) {
+            if (windowOk(k, JIT_WIN)) {
+                double fit = (15.0 * (T[k + 12] + T[k + 24]) - 6.0 * (T[k + 6] + T[k + 30]) + T[k] + T[k + 36]) / 20.0;
+                out.push_back((float)fabs(T[k + 18] - fit));
+            }
+        }
+    });
+    std::vector<float> jitter;
+    for (auto &p : jitPart) {
+        jitter.insert(jitter.end(), p.begin(), p.end());
+        p.clear();
+        p.shrink_to_fit();
+    }
+    double jitSq = 0.0;
+    for (float j : jitter) jitSq += (double)j * j;
+    const double jitRms = jitter.empty() ? 0.0 : sqrt(jitSq / jitter.size());
+
+    /* Mechanical speed over each interval [rpm] */
+    double angle[7];
+    for (int s = 0; s <= 6; s++) {
+        angle[s] = compensate && mis[s].count ? mis[s].mean() : 60.0;
+    }
+    const double rpmScale = 1e6 * 60.0 / 360.0 / polePair;
+    const double rpmMean = period.count ? 60e6 / period.mean() / polePair : 0.0;
+    std::vector<float> spd(nInt);
+    parallelFor(nThread, nInt, [&](size_t b, size_t e, unsigned) {
+        for (size_t k = b; k < e; k++) {
+            spd[k] = bad[k] ? (float)rpmMean : (float)(angle[hallSec[k]] / dt[k] * rpmScale);
+        }
+    });
+
+    /* Resample speed on a uniform grid at the mean edge rate */
+    const double span = T[nInt];
+    const double fs = nInt / span * 1e6;    /* [Hz] */
+    const size_t nGrid = (size_t)(span * 1e-6 * fs);
+    std::vector<float> grid(nGrid);
+    parallelFor(nThread, nGrid, [&](size_t b, size_t e, unsigned) {
+        double tau = (b + 0.5) / fs * 1e6;
+        size_t k = std::upper_bound(T.begin(), T.end(), tau) - T.begin() - 1;
+        for (size_t j = b; j < e; j++) {
+            tau = (j + 0.5) / fs * 1e6;
+            while (k + 1 < nInt && T[k + 1] <= tau) k++;
+            grid[j] = spd[k];
+        }
+    });
+    spd.clear();
+    spd.shrink_to_fit();
+
+    double gSum = 0.0, gSumSq = 0.0;
+    for (float g : grid) {
+        gSum += g;
+        gSumSq += (double)g * g;
+    }
+    const double gMean = nGrid ? gSum / nGrid : 0.0;
+    const double gStd = nGrid ? sqrt(std::max(0.0, gSumSq / nGrid - gMean * gMean)) : 0.0;
+
+    /* Welch spectrum of the speed ripple with a Hann window and 50% overlap */
+    while (fftN > nGrid && fftN > 16) fftN >>= 1;
+    const size_t nSeg = nGrid >= fftN ? (nGrid - fftN) / (fftN / 2) + 1 : 0;
+    std::vector<double> win(fftN);
+    double winSq = 0.0;
+    for (size_t n = 0; n < fftN; n++) {
+        win[n] = 0.5 - 0.5 * cos(2.0 * M_PI * n / fftN);
+        winSq += win[n] * win[n];
+    }
+    std::vector<std::vector<double>> psdPart(nThread, std::vector<double>(fftN / 2 + 1, 0.0));
+    parallelFor(nThread, nSeg, [&](size_t b, size_t e, unsigned th) {
+        std::vector<std::complex<double>> x(fftN);
+        std::vector<double> &psd = psdPart[th];
+        for (size_t g = b; g < e; g++) {
+            const float *seg = &grid[g * (fftN / 2)];
+            double m = 0.0;
+            for (size_t n = 0; n < fftN; n++) m += seg[n];
+            m /= fftN;
+            for (size_t n = 0; n < fftN; n++) x[n] = (seg[n] - m) * win[n];
+            fft(x);
+            for (size_t n = 0; n <= fftN / 2; n++) psd[n] += std::norm(x[n]);
+        }
+    }, 1);
+    std::vector<double> psd(fftN / 2 + 1, 0.0);
+    for (auto &p : psdPart) {
+        for (size_t n = 0; n <= fftN / 2; n++) psd[n] += p[n];
+    }
+
+    /* Pick the largest local maxima, amplitude from the energy around each peak; */
+    /* a maximum whose bins overlap those of a larger one belongs to the same line, */
+    /* e.g. a flat top or a sidelobe of the window */
+    struct Line { size_t bin; double freq, amp; };
+    std::vector<Line> line;
+    for (size_t n = PK_BIN; nSeg && n + PK_BIN <= fftN / 2; n++) {
+        if (psd[n] < psd[n - 1] || psd[n] < psd[n + 1]) continue;
+        double e = 0.0, f = 0.0;
+        for (size_t q = n - PK_BIN; q <= n + PK_BIN; q++) {
+            e += psd[q];
+            f += psd[q] * q;
+        }
+        line.push_back({n, f / e * fs / fftN, sqrt(4.0 * e / nSeg / (fftN * winSq))});
+    }
+    std::sort(line.begin(), line.end(), [](const Line &a, const Line &b) { return a.amp > b.amp; });
+    std::vector<size_t> kept;
+    res->peak.clear();
+    for (auto &l : line) {
+        bool near = false;
+        for (size_t n : kept) {
+            near |= (l.bin > n ? l.bin - n : n - l.bin) <= 2 * PK_BIN;
+        }
+        if (!near) {
+            kept.push_back(l.bin);
+            res->peak.push_back({l.bin, l.freq, l.amp});
+        }
+    }
+
+
+    /* Merge current sums */
+    uint64_t nCur[7] = {}, nCurAll = 0, commMismatch = 0;
+    double curSum[3] = {}, curSumSq[3] = {}, linkSum[7] = {};
+    for (auto &c : chunk) {
+        for (int q = 0; q <= 6; q++) {
+            nCur[q] += c.nCur[q];
+            nCurAll += c.nCur[q];
+            linkSum[q] += c.linkSum[q];
+        }
+        for (int p = 0; p < 3; p++) {
+            curSum[p] += c.curSum[p];
+            curSumSq[p] += c.curSumSq[p];
+        }
+        commMismatch += c.commMismatch;
+    }
+
+    /* Results */
+    res->nRec = nRec;
+    res->nHall = nHall;
+    res->nComm = nComm;
+    res->nCur = nCurAll;
+    res->nBad = nBad;
+    res->span = span;
+    res->perMean = period.mean();
+    res->perStd = period.stdev();
+    res->perMin = period.count ? period.min : 0.0;
+    res->perMax = period.max;
+    res->rpmMean = rpmMean;
+    for (int q = 0; q <= 6; q++) {
+        res->secCount[q] = sec[q].count;
+        res->secMean[q] = sec[q].mean();
+        res->secStd[q] = sec[q].stdev();
+        res->secMin[q] = sec[q].count ? sec[q].min : 0.0;
+        res->secMax[q] = sec[q].max;
+        res->width[q] = mis[q].mean();
+        res->link[q] = nCur[q] ? linkSum[q] / nCur[q] : 0.0;
+    }
+    res->jitRms = jitRms;
+    res->edgeSigma = jitRms / sqrt(JIT_VAR);
+
+    /* Residuals scaled to the edge timing noise, the same as edgeSigma to jitRms */
+    for (float &j : jitter) j = (float)(j / sqrt(JIT_VAR));
+    res->jit = percentiles(jitter);
+
+    std::vector<float> d;
+    d.reserve(nComm);
+    for (float x : commDelay) {
+        if (!isnan(x)) d.push_back(x);
+    }
+    double dSum = 0.0;
+    for (float x : d) dSum += x;
+    res->delayMean = d.empty() ? 0.0 : dSum / d.size();
+    res->delay = percentiles(d);
+    res->commMismatch = commMismatch;
+
+    for (int p = 0; p < 3; p++) {
+        res->curRms[p] = nCurAll ? sqrt(curSumSq[p] / nCurAll) : 0.0;
+        res->curMean[p] = nCurAll ? curSum[p] / nCurAll : 0.0;
+    }
+    res->rippleStd = gStd;
+    res->rippleMean = gMean;
+    res->fs = fs;
+    res->fftN = fftN;
+    res->nSeg = nSeg;
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * tlog_stats.h
+ * Statistics of bench captures of the BLDC 6-pulse drive
+ * Shared by the log analyzer and the self-check against synthetic captures
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#ifndef TLOG_STATS_H
+#define TLOG_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "telemetry_log.h"
+
+/* Define analysis parameters */
+#define FFT_N   65536   /* Default FFT segment length for the speed ripple spectrum */
+#define PEAKS   5       /* Default number of spectrum peaks to report */
+#define PK_BIN  3       /* Bins on each side of a peak summed for its amplitude */
+#define JIT_WIN 36      /* Intervals spanned by the jitter fit: six electrical cycles */
+#define JIT_VAR (231.0 / 100.0) /* Jitter residual variance per unit edge variance */
+
+/* Analysis options */
+struct TlogOpt {
+    unsigned nThread;   /* Number of worker threads */
+    size_t fftN;        /* FFT segment length, power of two */
+    bool compensate;    /* Compensate Hall misalignment in the speed */
+};
+
+/* Percentiles of a distribution */
+struct Pctl {
+    double p50, p90, p99, p999, max;
+};
+
+/* Spectrum peak */
+struct Peak {
+    size_t bin;         /* FFT bin of the local maximum */
+    double freq;        /* [Hz] */
+    double amp;         /* [rpm] Amplitude */
+};
+
+/* Analysis results */
+struct TlogStats {
+    size_t nRec, nHall, nComm;
+    uint64_t nCur;              /* Current samples */
+    uint64_t nBad;              /* Hall sequence errors */
+    double span;                /* [microsecond] From the first to the last Hall edge */
+
+    double perMean, perStd, perMin, perMax; /* [microsecond] Electrical period */
+    double rpmMean;             /* [rpm] */
+
+    uint64_t secCount[7];       /* Per sector 1-6 */
+    double secMean[7], secStd[7], secMin[7], secMax[7];    /* [microsecond] */
+    double width[7];            /* [deg] Electrical width */
+
+    double jitRms;              /* [microsecond] Residual of the edge fit */
+    double edgeSigma;           /* [microsecond] Edge timing noise */
+    Pctl jit;                   /* [microsecond] Edge timing noise magnitude: residual / sqrt(JIT_VAR) */
+
+    double delayMean;           /* [microsecond] Commutation delay after Hall edge */
+    Pctl delay;
+    uint64_t commMismatch;      /* Commutations not matching the last Hall sector */
+
+    double curRms[3], curMean[3];   /* [mA] */
+    double link[7];             /* [mA] DC link current estimate per sector */
+
+    double rippleStd, rippleMean;   /* [rpm] Speed on the uniform grid */
+    double fs;                  /* [Hz] Grid rate */
+    size_t fftN, nSeg;
+    std::vector<Peak> peak;     /* Largest first, one per spectral line */
+};
+
+/* Define function prototypes */
+int tlogAnalyze(const TelemetryRecord *rec, size_t nRec, unsigned polePair, const TlogOpt &opt, TlogStats *res);
+
+#endif /* TLOG_STATS_H */
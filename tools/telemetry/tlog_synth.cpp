@@ -0,0 +1,121 @@
+/*
+ * tlog_synth.cpp
+ * Synthetic bench captures with known speed ripple, Hall sensor misalignment,
+ * edge jitter and commutation delay
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#include <math.h>
+
+#include <random>
+
+#include "tlog_synth.h"
+
+/* Simulation state */
+struct Motor {
+    double w0;          /* [rev/s] Mean mechanical speed */
+    double rip;         /* Relative ripple amplitude */
+    double fRip;        /* [Hz] Ripple frequency */
+    unsigned polePair;
+};
+
+/* Function prototypes, local */
+static double elecAngle(const Motor &m, double t);
+static double elecSpeed(const Motor &m, double t);
+
+/* Function to obtain the electrical angle [deg] at time t [s] */
+static double elecAngle(const Motor &m, double t)
+{
+    double rev = m.w0 * (t + m.rip / (2.0 * M_PI * m.fRip) * (1.0 - cos(2.0 * M_PI * m.fRip * t)));
+    return 360.0 * m.polePair * rev;
+}
+
+/* Function to obtain the electrical speed [deg/s] at time t [s] */
+static double elecSpeed(const Motor &m, double t)
+{
+    return 360.0 * m.polePair * m.w0 * (1.0 + m.rip * sin(2.0 * M_PI * m.fRip * t));
+}
+
+/* Function to set the default parameters */
+void synthDefault(SynthParam *p)
+{
+    *p = SynthParam{SECONDS, RPM, P_PAIR, JITTER, RIPPLE, F_RIP, {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0},
+                    DELAY, F_CUR, I_AMP, 1};
+}
+
+/* Function to generate a capture, records passed to emit in time order */
+void tlogSynth(const SynthParam &p, const std::function<void(const TelemetryRecord &)> &emit, SynthExpect *x)
+{
+    Motor m = {p.rpm / 60.0, p.ripple / 100.0, p.fRip, p.polePair};
+    std::mt19937_64 rng(p.seed);
+    std::normal_distribution<double> noise(0.0, p.jitter);
+    int i;
+
+    auto put = [&](uint32_t tick, uint8_t kind, uint8_t sector, double t) {
+        TelemetryRecord r = {tick, kind, sector, 0, 0, 0};
+        if (kind == REC_CURRENT) {
+            double th = elecAngle(m, t) * M_PI / 180.0;
+            double ia = p.iAmp * sin(th);
+            double ib = p.iAmp * sin(th - 2.0 * M_PI / 3.0);
+            r.ia = (int16_t)lround(ia);
+            r.ib = (int16_t)lround(ib);
+            r.ic = (int16_t)lround(-ia - ib);
+        }
+        emit(r);
+    };
+
+    /* Generate Hall edges by solving the angle equation, then fill in the other events */
+    uint64_t k, nEdge = 0;
+    double t = 0.0, tNext, tCur = 0.0;
+    unsigned sector;
+    auto solve = [&](uint64_t edge, double guess) {
+        double target = 60.0 * edge + p.offset[edge % 6 + 1];
+        for (int n = 0; n < 4; n++) {
+            guess -= (elecAngle(m, guess) - target) / elecSpeed(m, guess);
+        }
+        return guess;
+    };
+    t = solve(0, 0.0);
+    for (k = 0; t < p.seconds; k++) {
+        sector = k % 6 + 1;
+        tNext = solve(k + 1, t + 60.0 / elecSpeed(m, t));
+
+        /* Hall edge with timing noise, commutation triggered by the observed edge */
+        uint32_t tick = TICK_0 + (uint32_t)llround(t * 1e6 + noise(rng));
+        put(tick, REC_HALL, sector, t);
+        nEdge++;
+        double tComm = t + p.delay * 1e-6;
+
+        /* Current samples up to the next edge, with the commutation in between */
+        bool commDone = false;
+        while (tCur < tNext) {
+            if (!commDone && tComm <= tCur) {
+                put(tick + p.delay, REC_COMM, sector, tComm);
+                commDone = true;
+            }
+            if (tCur >= t) {
+                put(TICK_0 + (uint32_t)llround(tCur * 1e6), REC_CURRENT, 0, tCur);
+            }
+            tCur += 1.0 / p.fCur;
+        }
+        if (!commDone) {
+            put(tick + p.delay, REC_COMM, sector, tComm);
+        }
+        t = tNext;
+    }
+
+    /* Expected statistics */
+    x->nEdge = nEdge;
+    x->rpm = p.rpm;
+    x->period = 1e6 / (m.w0 * p.polePair);
+    x->widthErr[0] = 0.0;
+    for (i = 1; i <= 6; i++) {
+        x->widthErr[i] = p.offset[i % 6 + 1] - p.offset[i];
+    }
+    x->edgeSigma = sqrt(p.jitter * p.jitter + 1.0 / 12.0);
+    x->rippleAmp = p.rpm * m.rip;
+    x->rippleFreq = p.fRip;
+    x->delay = p.delay;
+    x->curRms = p.iAmp / sqrt(2.0);
+}
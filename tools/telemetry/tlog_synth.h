@@ -0,0 +1,63 @@
+/*
+ * tlog_synth.h
+ * Synthetic bench captures with known speed ripple, Hall sensor misalignment,
+ * edge jitter and commutation delay
+ * Shared by the capture generator and the self-check of the analyzer
+ * Released under the MIT lisence
+ * https://opensource.org/licenses/mit-license.php
+ */
+
+#ifndef TLOG_SYNTH_H
+#define TLOG_SYNTH_H
+
+#include <stdint.h>
+
+#include <functional>
+
+#include "telemetry_log.h"
+
+/* Define default simulation parameters */
+#define SECONDS 10.0    /* [s] Capture length */
+#define RPM     1000.0  /* [rpm] Mean mechanical speed */
+#define P_PAIR  7       /* Number of pole pairs */
+#define JITTER  0.5     /* [microsecond] Standard deviation of Hall edge timing noise */
+#define RIPPLE  2.0     /* [%] Speed ripple amplitude */
+#define F_RIP   5.0     /* [Hz] Speed ripple frequency */
+#define DELAY   3       /* [microsecond] Commutation delay after Hall edge */
+#define F_CUR   10000.0 /* [Hz] Current sampling frequency */
+#define I_AMP   1000.0  /* [mA] Phase current amplitude */
+#define TICK_0  0xFFF00000u /* [microsecond] Timestamp of t = 0, close to wrap around */
+
+/* Simulated motor and capture */
+struct SynthParam {
+    double seconds;     /* [s] Capture length */
+    double rpm;         /* [rpm] Mean mechanical speed */
+    unsigned polePair;
+    double jitter;      /* [microsecond] Standard deviation of Hall edge timing noise */
+    double ripple;      /* [%] Speed ripple amplitude */
+    double fRip;        /* [Hz] Speed ripple frequency */
+    double offset[7];   /* [deg] Offsets of the Hall edges entering sector 1-6, electrical */
+    unsigned delay;     /* [microsecond] Commutation delay after Hall edge */
+    double fCur;        /* [Hz] Current sampling frequency */
+    double iAmp;        /* [mA] Phase current amplitude */
+    unsigned long seed; /* Noise generator seed */
+};
+
+/* Statistics the analyzer should recover */
+struct SynthExpect {
+    uint64_t nEdge;     /* Hall edges */
+    double rpm;         /* [rpm] Rotational speed */
+    double period;      /* [microsecond] Electrical period */
+    double widthErr[7]; /* [deg] Width error of sector 1-6, electrical */
+    double edgeSigma;   /* [microsecond] Edge timing noise including 1 us quantization */
+    double rippleAmp;   /* [rpm] Speed ripple amplitude */
+    double rippleFreq;  /* [Hz] */
+    double delay;       /* [microsecond] Commutation delay */
+    double curRms;      /* [mA] Phase current rms */
+};
+
+/* Define function prototypes */
+void synthDefault(SynthParam *p);
+void tlogSynth(const SynthParam &p, const std::function<void(const TelemetryRecord &)> &emit, SynthExpect *x);
+
+#endif /* TLOG_SYNTH_H */